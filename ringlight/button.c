@@ -8,53 +8,57 @@
 
 #define DEBOUNCE_MS 10
 
-typedef struct {
-	uint8_t gpio;
-	bool state;
-	bool last_state;
-	bool debounce;
-	os_task_t debounce_task;
-} button_t;
-
-#define BUTTON(gpio) { gpio, false, false, false, OS_TASK_INITIALIZER }
-
-static button_t buttons_g[] = {
-	BUTTON(GPIO_BRIGHTER),
-	BUTTON(GPIO_DIMMER),
-	BUTTON(GPIO_WARMER),
-	BUTTON(GPIO_COLDER),
+static const uint8_t button_gpios_g[] = {
+#if ENCODER_ENABLE
+	// Brightness is controlled by the encoder
+	GPIO_NONE,
+	GPIO_NONE,
+#else
+	GPIO_BRIGHTER,
+	GPIO_DIMMER,
+#endif
+	GPIO_WARMER,
+	GPIO_COLDER,
 };
 
+// Runtime state, one bit per button
+static uint8_t buttons_state = 0;
+static uint8_t buttons_last_state = 0;
+static uint8_t buttons_debounce = 0;
+static os_task_t debounce_tasks_g[ARRAY_SIZE(button_gpios_g)];
+_Static_assert(ARRAY_SIZE(button_gpios_g) <= 8, "button bitmaps too small");
+
 static void debounce_cb(void *ctx) {
-	button_t *button = ctx;
+	os_task_t *task = ctx;
 
-	button->debounce = false;
+	buttons_debounce &= ~BIT(task - debounce_tasks_g);
 }
 
 void button_update(void) {
 	unsigned i;
 
-	for (i = 0; i < ARRAY_SIZE(buttons_g); i++) {
-		button_t *button = &buttons_g[i];
-		bool state = gpiod_get(button->gpio);
-
-		if (state != button->last_state) {
-			if (!button->debounce) {
-				button->state = state;
-			}
-			button->debounce = true;
-			os_schedule_task_relative(&button->debounce_task, debounce_cb, MS_TO_US(DEBOUNCE_MS), button);
-		} else {
-			if (!button->debounce) {
-				button->state = state;
-			}
+	for (i = 0; i < ARRAY_SIZE(button_gpios_g); i++) {
+		uint8_t gpio = button_gpios_g[i];
+		uint8_t mask = BIT(i);
+		uint8_t state;
+
+		if (gpio == GPIO_NONE) {
+			continue;
 		}
-		button->last_state = state;
+
+		state = gpiod_get(gpio) ? mask : 0;
+
+		if (!(buttons_debounce & mask)) {
+			buttons_state = (buttons_state & ~mask) | state;
+		}
+		if (state != (buttons_last_state & mask)) {
+			buttons_debounce |= mask;
+			os_schedule_task_relative(&debounce_tasks_g[i], debounce_cb, MS_TO_US(DEBOUNCE_MS), &debounce_tasks_g[i]);
+		}
+		buttons_last_state = (buttons_last_state & ~mask) | state;
 	}
 }
 
 bool button_get_state(unsigned button_id) {
-	button_t *button = &buttons_g[button_id];
-
-	return button->state;
+	return buttons_state & BIT(button_id);
 }
@@ -2,10 +2,19 @@
 
 #include <stdbool.h>
 
+#include "os.h"
+#include "os_coro.h"
+
 #define BUTTON_BRIGHTER 0
 #define BUTTON_DIMMER 1
 #define BUTTON_WARMER 2
 #define BUTTON_COOLER 3
 
+#define BUTTON_AWAIT_POLL_MS 5
+
+// Resume coroutine task once button_id is in state pressed
+#define BUTTON_CORO_AWAIT(task, button_id, pressed) \
+	OS_CORO_AWAIT_UNTIL(task, button_get_state(button_id) == (pressed), MS_TO_US(BUTTON_AWAIT_POLL_MS))
+
 void button_update(void);
 bool button_get_state(unsigned button_id);
@@ -0,0 +1,96 @@
+#include "diag.h"
+
+#include <libopencm3/cm3/systick.h>
+#include <libopencm3/stm32/rcc.h>
+
+#include "os.h"
+#include "util.h"
+
+#define DIAG_UPDATE_INTERVAL_MS 1000
+#define DIAG_STACK_PAINT 0xA5A5A5A5UL
+// Don't paint the last bytes below the current stack pointer
+#define DIAG_STACK_PAINT_GUARD 16
+
+// Provided by the libopencm3 linker script
+extern uint32_t _ebss;
+extern uint32_t _stack;
+
+volatile diag_t diag_g;
+
+static uint32_t boot_elapsed_us = 0;
+
+static os_task_t diag_task = OS_TASK_INITIALIZER;
+
+static inline uint32_t *diag_get_sp(void) {
+	uint32_t *sp;
+
+	__asm__ volatile("mov %0, sp" : "=r" (sp));
+	return sp;
+}
+
+/*
+ * Must be called early in main(). Fills all RAM below
+ * the current stack frame with a known pattern to allow
+ * finding the stack high-watermark later on.
+ */
+void diag_stack_paint(void) {
+	uint32_t *limit = diag_get_sp() - DIAG_STACK_PAINT_GUARD / sizeof(uint32_t);
+	uint32_t *ptr = &_ebss;
+
+	while (ptr < limit) {
+		*ptr++ = DIAG_STACK_PAINT;
+	}
+}
+
+/*
+ * Boot time is measured with SysTick, running at AHB / 8 from the
+ * very start of main(). Time spent in the reset handler before
+ * main() is not accounted for. With the 48 MHz PLL clock the
+ * counter wraps after ~2.8s.
+ */
+void diag_boot_timer_start(void) {
+	systick_set_clocksource(STK_CSR_CLKSOURCE_AHB_DIV8);
+	systick_set_reload(STK_RVR_RELOAD);
+	systick_clear();
+	systick_counter_enable();
+}
+
+static uint32_t diag_boot_timer_us(uint32_t ahb_hz) {
+	uint32_t ticks = STK_RVR_RELOAD - systick_get_value();
+
+	if (systick_get_countflag()) {
+		diag_g.boot_time_overflow = true;
+	}
+	return ticks / (ahb_hz / 8 / MHZ(1));
+}
+
+// Call right after switching the system clock
+void diag_boot_clock_changed(uint32_t prev_ahb_hz) {
+	boot_elapsed_us += diag_boot_timer_us(prev_ahb_hz);
+	systick_clear();
+}
+
+void diag_boot_lit(void) {
+	diag_g.boot_time_us = boot_elapsed_us + diag_boot_timer_us(rcc_ahb_frequency);
+}
+
+static uint32_t diag_stack_max_used(void) {
+	uint32_t *ptr = &_ebss;
+
+	while (ptr < &_stack && *ptr == DIAG_STACK_PAINT) {
+		ptr++;
+	}
+	return paddr__(&_stack) - paddr__(ptr);
+}
+
+static void diag_task_cb(void *ctx) {
+	(void)ctx;
+
+	diag_g.stack_max_used = diag_stack_max_used();
+	os_schedule_task_relative(&diag_task, diag_task_cb, MS_TO_US(DIAG_UPDATE_INTERVAL_MS), NULL);
+}
+
+void diag_init(void) {
+	diag_g.stack_size = paddr__(&_stack) - paddr__(&_ebss);
+	diag_task_cb(NULL);
+}
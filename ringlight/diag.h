@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Runtime diagnostics
+ *
+ * Everything collected here ends up in diag_g. There is no
+ * communication interface, read it with a debugger:
+ *	(gdb) print diag_g
+ */
+
+typedef struct {
+	uint32_t stack_size; // bytes between end of .bss and top of RAM
+	uint32_t stack_max_used; // stack high-watermark in bytes
+	uint32_t boot_time_us; // main() to the first lit PWM period, 0 if not yet lit
+	bool boot_time_overflow; // boot_time_us is invalid, took too long
+	uint16_t shutter_period_us; // measured camera frame period, 0 if unlocked
+	uint16_t shutter_jitter_us; // largest frame period deviation while locked, all locks
+	uint16_t shutter_relocks; // locks after the first, frame period changed or signal came back
+	uint8_t shutter_divisor; // PWM periods per camera frame
+} diag_t;
+
+extern volatile diag_t diag_g;
+
+void diag_stack_paint(void);
+void diag_boot_timer_start(void);
+void diag_boot_clock_changed(uint32_t prev_ahb_hz);
+void diag_boot_lit(void);
+void diag_init(void);
@@ -0,0 +1,71 @@
+#include "encoder.h"
+
+#if ENCODER_ENABLE
+
+#include <stdint.h>
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+
+#include "os.h"
+#include "util.h"
+#include "velocity.h"
+
+/*
+ * Quadrature decoding is done by the timer in encoder mode, no
+ * interrupts involved. The counter is sampled every
+ * ENCODER_POLL_MS and the number of detents turned since
+ * is mapped to brightness steps.
+ */
+#define ENCODER_TIMER TIM3
+#define ENCODER_TIMER_RCC RCC_TIM3
+#define ENCODER_TIMER_RST RST_TIM3
+#define ENCODER_TIMER_TOP (0xFFFF)
+
+#define ENCODER_POLL_MS 50
+#define ENCODER_COUNTS_PER_DETENT 4
+
+// Brightness steps per detent, by detents turned within one poll interval
+static const uint8_t encoder_accel[] = { 0, 5, 5, 10, 15, 20, 30, 40, 50 };
+
+static uint16_t last_count = 0;
+static os_task_t encoder_task = OS_TASK_INITIALIZER;
+
+static void encoder_task_cb(void *ctx) {
+	uint16_t count = timer_get_counter(ENCODER_TIMER);
+	// Wraps correctly as long as less than 32k counts per poll interval
+	int16_t delta = count - last_count;
+	int detents = delta / ENCODER_COUNTS_PER_DETENT;
+	unsigned speed = MIN((unsigned)ABS(detents), ARRAY_SIZE(encoder_accel) - 1);
+
+	(void)ctx;
+
+	os_schedule_task_relative(&encoder_task, encoder_task_cb, MS_TO_US(ENCODER_POLL_MS), NULL);
+
+	if (!detents) {
+		return;
+	}
+	// Partial detents are carried over to the next poll
+	last_count += detents * ENCODER_COUNTS_PER_DETENT;
+	velocity_set_value(VELOCITY_BRIGHTNESS,
+			   velocity_get_value(VELOCITY_BRIGHTNESS) + detents * encoder_accel[speed]);
+}
+
+void encoder_init(void) {
+	rcc_periph_clock_enable(ENCODER_TIMER_RCC);
+	rcc_periph_reset_pulse(ENCODER_TIMER_RST);
+
+	timer_set_period(ENCODER_TIMER, ENCODER_TIMER_TOP);
+	timer_slave_set_mode(ENCODER_TIMER, TIM_SMCR_SMS_EM3);
+	timer_ic_set_input(ENCODER_TIMER, TIM_IC1, TIM_IC_IN_TI1);
+	timer_ic_set_input(ENCODER_TIMER, TIM_IC2, TIM_IC_IN_TI2);
+	// Suppress contact bounce shorter than ~5us
+	timer_ic_set_filter(ENCODER_TIMER, TIM_IC1, TIM_IC_DTF_DIV_32_N_8);
+	timer_ic_set_filter(ENCODER_TIMER, TIM_IC2, TIM_IC_DTF_DIV_32_N_8);
+	timer_enable_counter(ENCODER_TIMER);
+
+	last_count = timer_get_counter(ENCODER_TIMER);
+	os_schedule_task_relative(&encoder_task, encoder_task_cb, MS_TO_US(ENCODER_POLL_MS), NULL);
+}
+
+#endif
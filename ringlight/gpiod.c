@@ -6,24 +6,67 @@
 #include "util.h"
 
 #define GPIO_FLAG_INVERTED	BIT(0)
-#define GPIO_FLAG_ON		BIT(1)
-#define GPIO_FLAG_FORCE_OUT_OPT	BIT(2)
+#define GPIO_FLAG_FORCE_OUT_OPT	BIT(1)
+// Set up before everything else by gpiod_init_early()
+#define GPIO_FLAG_EARLY		BIT(2)
 
 #define GPIO_AF_GPIO 0xff
 
-static gpio_t gpios_g[] = {
+static const gpio_t gpios_g[] = {
+#if ENCODER_ENABLE
+	{ GPIOA, GPIO6,  GPIO_MODE_AF,    GPIO_PUPD_PULLUP, 0, 0, GPIO_AF1, 0 }, // encoder A (TIM3 CH1)
+	{ GPIOA, GPIO7,  GPIO_MODE_AF,    GPIO_PUPD_PULLUP, 0, 0, GPIO_AF1, 0 }, // encoder B (TIM3 CH2)
+#else
 	{ GPIOA, GPIO5,  GPIO_MODE_INPUT, GPIO_PUPD_PULLUP, 0, 0, 0, GPIO_FLAG_INVERTED }, // dimmer
 	{ GPIOA, GPIO6,  GPIO_MODE_INPUT, GPIO_PUPD_PULLUP, 0, 0, 0, GPIO_FLAG_INVERTED }, // brighter
-	{ GPIOA, GPIO9,  GPIO_MODE_AF,    GPIO_PUPD_NONE, GPIO_OTYPE_PP, GPIO_OSPEED_2MHZ, GPIO_AF2, GPIO_FLAG_FORCE_OUT_OPT }, // PWM warm (TIM1 CH2)
-	{ GPIOA, GPIO10, GPIO_MODE_AF,    GPIO_PUPD_NONE, GPIO_OTYPE_PP, GPIO_OSPEED_2MHZ, GPIO_AF2, GPIO_FLAG_FORCE_OUT_OPT }, // PWM cold (TIM1 CH3)
+#endif
+	{ GPIOA, GPIO9,  GPIO_MODE_AF,    GPIO_PUPD_NONE, GPIO_OTYPE_PP, GPIO_OSPEED_2MHZ, GPIO_AF2, GPIO_FLAG_FORCE_OUT_OPT | GPIO_FLAG_EARLY }, // PWM warm (TIM1 CH2)
+	{ GPIOA, GPIO10, GPIO_MODE_AF,    GPIO_PUPD_NONE, GPIO_OTYPE_PP, GPIO_OSPEED_2MHZ, GPIO_AF2, GPIO_FLAG_FORCE_OUT_OPT | GPIO_FLAG_EARLY }, // PWM cold (TIM1 CH3)
 /*
 	{ GPIOA, GPIO9,  GPIO_MODE_OUTPUT,    GPIO_PUPD_NONE, GPIO_OTYPE_PP, GPIO_OSPEED_2MHZ, 0, 0 }, // PWM warm (TIM1 CH2)
 	{ GPIOA, GPIO10, GPIO_MODE_OUTPUT,    GPIO_PUPD_NONE, GPIO_OTYPE_PP, GPIO_OSPEED_2MHZ, 0, 0 }, // PWM cold (TIM1 CH3)
 */
 	{ GPIOF, GPIO0,  GPIO_MODE_INPUT, GPIO_PUPD_PULLUP, 0, 0, 0, GPIO_FLAG_INVERTED }, // warmer
 	{ GPIOF, GPIO1,  GPIO_MODE_INPUT, GPIO_PUPD_PULLUP, 0, 0, 0, GPIO_FLAG_INVERTED }, // colder
+#if SYNC_MODE
+	{ GPIOA, GPIO2,  GPIO_MODE_AF,    GPIO_PUPD_PULLUP, GPIO_OTYPE_OD, GPIO_OSPEED_2MHZ, GPIO_AF1, GPIO_FLAG_FORCE_OUT_OPT }, // sync bus (USART1 TX, half-duplex)
+#elif SHUTTER_ENABLE
+	{ GPIOA, GPIO7,  GPIO_MODE_AF,    GPIO_PUPD_NONE, 0, 0, GPIO_AF1, 0 }, // camera frame trigger (TIM3 CH2)
+#endif
 };
 
+// Output state, one bit per gpio
+static uint8_t gpios_on = 0;
+_Static_assert(ARRAY_SIZE(gpios_g) <= 8, "gpios_on too small");
+
+static void gpiod_init_gpio(uint8_t gpionum) {
+	const gpio_t *gpio = &gpios_g[gpionum];
+
+	gpio_mode_setup(gpio->port, gpio->mode, gpio->pullcfg, gpio->gpio);
+	if (gpio->mode == GPIO_MODE_OUTPUT) {
+		gpiod_set(gpionum, 0);
+	}
+	if (gpio->mode == GPIO_MODE_OUTPUT || (gpio->flags & GPIO_FLAG_FORCE_OUT_OPT)) {
+		gpio_set_output_options(gpio->port, gpio->otype, gpio->ospeed, gpio->gpio);
+	}
+	if (gpio->mode == GPIO_MODE_AF) {
+		gpio_set_af(gpio->port, gpio->af, gpio->gpio);
+	}
+}
+
+// Only the gpios required to get the light on
+void gpiod_init_early() {
+	uint8_t i;
+
+	rcc_periph_clock_enable(RCC_GPIOA);
+
+	for (i = 0; i < ARRAY_SIZE(gpios_g); i++) {
+		if (gpios_g[i].flags & GPIO_FLAG_EARLY) {
+			gpiod_init_gpio(i);
+		}
+	}
+}
+
 void gpiod_init() {
 	uint8_t i;
 
@@ -31,39 +74,30 @@ void gpiod_init() {
 	rcc_periph_clock_enable(RCC_GPIOF);
 
 	for (i = 0; i < ARRAY_SIZE(gpios_g); i++) {
-		const gpio_t *gpio = &gpios_g[i];
-
-		gpio_mode_setup(gpio->port, gpio->mode, gpio->pullcfg, gpio->gpio);
-		if (gpio->mode == GPIO_MODE_OUTPUT) {
-			gpiod_set(i, 0);
-		}
-		if (gpio->mode == GPIO_MODE_OUTPUT || (gpio->flags & GPIO_FLAG_FORCE_OUT_OPT)) {
-			gpio_set_output_options(gpio->port, gpio->otype, gpio->ospeed, gpio->gpio);
-		}
-		if (gpio->mode == GPIO_MODE_AF) {
-			gpio_set_af(gpio->port, gpio->af, gpio->gpio);
+		if (!(gpios_g[i].flags & GPIO_FLAG_EARLY)) {
+			gpiod_init_gpio(i);
 		}
 	}
 }
 
 void gpiod_set(uint8_t gpionum, uint8_t value) {
-	gpio_t *gpio = &gpios_g[gpionum];
+	const gpio_t *gpio = &gpios_g[gpionum];
 
 	if (!value == !(gpio->flags & GPIO_FLAG_INVERTED)) {
-		if (gpio->flags & GPIO_FLAG_ON) {
+		if (gpios_on & BIT(gpionum)) {
 			gpio_clear(gpio->port, gpio->gpio);
-			gpio->flags &= ~GPIO_FLAG_ON;
+			gpios_on &= ~BIT(gpionum);
 		}
 	} else {
-		if (!(gpio->flags & GPIO_FLAG_ON)) {
+		if (!(gpios_on & BIT(gpionum))) {
 			gpio_set(gpio->port, gpio->gpio);
-			gpio->flags |= GPIO_FLAG_ON;
+			gpios_on |= BIT(gpionum);
 		}
 	}
 }
 
 uint16_t gpiod_get(uint8_t gpionum) {
-	gpio_t *gpio = &gpios_g[gpionum];
+	const gpio_t *gpio = &gpios_g[gpionum];
 
 	if (gpio->flags & GPIO_FLAG_INVERTED) {
 		return (~gpio_get(gpio->port, gpio->gpio)) & gpio->gpio;
@@ -72,9 +106,7 @@ uint16_t gpiod_get(uint8_t gpionum) {
 }
 
 void gpiod_toggle(uint8_t gpionum) {
-	gpio_t *gpio = &gpios_g[gpionum];
-
-	gpiod_set(gpionum, !(gpio->flags & GPIO_FLAG_ON));
+	gpiod_set(gpionum, !(gpios_on & BIT(gpionum)));
 }
 
 uint32_t gpiod_get_port(uint8_t gpionum) {
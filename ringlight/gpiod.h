@@ -2,12 +2,25 @@
 
 #include <stdint.h>
 
+#if ENCODER_ENABLE
+// The encoder takes the place of the dimmer/brighter buttons
+#define GPIO_ENCODER_A	0
+#define GPIO_ENCODER_B	1
+#else
 #define GPIO_DIMMER	0
 #define GPIO_BRIGHTER	1
+#endif
 #define GPIO_PWM_WARM	2
 #define GPIO_PWM_COLD	3
 #define GPIO_WARMER	4
 #define GPIO_COLDER	5
+#if SYNC_MODE
+#define GPIO_SYNC	6
+#elif SHUTTER_ENABLE
+#define GPIO_SHUTTER	6
+#endif
+
+#define GPIO_NONE	0xff
 
 typedef struct {
 	uint32_t port;
@@ -20,6 +33,7 @@ typedef struct {
 	uint8_t flags;
 } gpio_t;
 
+void gpiod_init_early(void);
 void gpiod_init(void);
 void gpiod_set(uint8_t gpionum, uint8_t value);
 uint16_t gpiod_get(uint8_t gpionum);
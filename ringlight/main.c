@@ -9,9 +9,14 @@
 #include <libopencm3/cm3/nvic.h>
 
 #include "button.h"
+#include "diag.h"
+#include "encoder.h"
 #include "gpiod.h"
 #include "isr.h"
 #include "os.h"
+#include "pwm.h"
+#include "shutter.h"
+#include "sync.h"
 #include "velocity.h"
 
 const uint16_t gamma16[] = {
@@ -101,29 +106,6 @@ static void clock_init(void) {
 	rcc_clock_setup_in_hsi_out_48mhz();
 }
 
-#define TIMER_TOP	1000
-#define TIMER_DEFAULT	0
-
-static void pwm_init(void) {
-	rcc_periph_clock_enable(RCC_TIM1);
-	rcc_periph_reset_pulse(RST_TIM1);
-
-	timer_set_mode(TIM1, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
-	timer_set_prescaler(TIM1, 47); // prescaler runs at 48 MHz, timer at 1Mhz
-	timer_disable_preload(TIM1);
-	timer_continuous_mode(TIM1);
-	timer_set_period(TIM1, TIMER_TOP);
-	timer_enable_break_main_output(TIM1);
-	timer_update_on_overflow(TIM1);
-	timer_set_oc_mode(TIM1, TIM_OC2, TIM_OCM_PWM1);
-	timer_set_oc_mode(TIM1, TIM_OC3, TIM_OCM_PWM1);
-	timer_enable_oc_output(TIM1, TIM_OC2);
-	timer_enable_oc_output(TIM1, TIM_OC3);
-	timer_set_oc_value(TIM1, TIM_OC2, TIMER_DEFAULT);
-	timer_set_oc_value(TIM1, TIM_OC3, TIMER_DEFAULT);
-	timer_enable_counter(TIM1);
-}
-
 static void exti_init(void) {
 	rcc_periph_clock_enable(RCC_SYSCFG_COMP);
 
@@ -136,17 +118,20 @@ static void exti_init(void) {
 
 	exti_set_trigger(EXTI0, EXTI_TRIGGER_FALLING);
 	exti_set_trigger(EXTI1, EXTI_TRIGGER_FALLING);
-	exti_set_trigger(EXTI5, EXTI_TRIGGER_FALLING);
-	exti_set_trigger(EXTI6, EXTI_TRIGGER_FALLING);
 	exti_enable_request(EXTI0);
 	exti_enable_request(EXTI1);
-	exti_enable_request(EXTI5);
-	exti_enable_request(EXTI6);
-
 	exti_select_source(EXTI0, GPIOF);
 	exti_select_source(EXTI1, GPIOF);
+
+#if !ENCODER_ENABLE
+	// PA5/PA6 are encoder inputs otherwise, every edge would interrupt
+	exti_set_trigger(EXTI5, EXTI_TRIGGER_FALLING);
+	exti_set_trigger(EXTI6, EXTI_TRIGGER_FALLING);
+	exti_enable_request(EXTI5);
+	exti_enable_request(EXTI6);
 	exti_select_source(EXTI5, GPIOA);
 	exti_select_source(EXTI6, GPIOA);
+#endif
 }
 
 static void exti_common(void) {
@@ -167,50 +152,86 @@ void exti4_15_isr(void) {
 	exti_common();
 }
 
+// Duties for the current brightness and temperature
+static void light_duty(uint16_t *warm, uint16_t *cold) {
+	int brightness;
+	int temperature;
+	int brightness_warm;
+	int brightness_cold;
+
+	brightness = velocity_get_value(VELOCITY_BRIGHTNESS);
+	temperature = velocity_get_value(VELOCITY_TEMPERATURE);
+	if (temperature >= 500) {
+		brightness_warm = brightness;
+		brightness_cold = brightness * (1000 - temperature) / 500;
+	} else {
+		brightness_warm = brightness * temperature / 500;
+		brightness_cold = brightness;
+	}
+
+	*warm = gamma16[brightness_warm * PWM_TOP / 1000];
+	*cold = gamma16[brightness_cold * PWM_TOP / 1000];
+}
+
+static void light_update(void) {
+	uint16_t warm, cold;
+
+	light_duty(&warm, &cold);
+	pwm_set_duty(warm, cold);
+}
+
 int main(void) {
 	int off_x = 0, off_y = 0, cycles = 0;
 	int led_count = 0;
+	uint32_t hsi_hz = rcc_ahb_frequency;
+	uint16_t warm, cold;
+
+	diag_boot_timer_start();
+
+	// Get the light on first, still running from HSI
+	gpiod_init_early();
+	light_duty(&warm, &cold);
+	pwm_init(warm, cold);
+
+	// Early init stack usage is shallow, not worth delaying the light for
+	diag_stack_paint();
 
 	clock_init();
+	diag_boot_clock_changed(hsi_hz);
+	pwm_clock_update();
+
 	gpiod_init();
-	pwm_init();
 	exti_init();
 	os_init();
+	diag_init();
+#if ENCODER_ENABLE
+	encoder_init();
+#endif
+#if SYNC_MODE
+	sync_init();
+#endif
+#if SHUTTER_ENABLE
+	shutter_init();
+#endif
 
 	while (1) {
-		int brightness;
-		int temperature;
-		int brightness_warm;
-		int brightness_cold;
-
 		os_run();
 		button_update();
 		velocity_update();
 
 		if (velocity_both_pressed(VELOCITY_BRIGHTNESS)) {
-			velocity_set_value(VELOCITY_BRIGHTNESS, 50);
+			velocity_set_value(VELOCITY_BRIGHTNESS, VELOCITY_BRIGHTNESS_RESET);
 		}
 
 		if (velocity_both_pressed(VELOCITY_TEMPERATURE)) {
-			velocity_set_value(VELOCITY_TEMPERATURE, 500);
+			velocity_set_value(VELOCITY_TEMPERATURE, VELOCITY_TEMPERATURE_RESET);
 		}
 
-		brightness = velocity_get_value(VELOCITY_BRIGHTNESS);
-		temperature = velocity_get_value(VELOCITY_TEMPERATURE);
-		if (temperature >= 500) {
-			brightness_warm = brightness;
-			brightness_cold = brightness * (1000 - temperature) / 500;
-		} else {
-			brightness_warm = brightness * temperature / 500;
-			brightness_cold = brightness;
-		}
+#if SYNC_MODE
+		sync_update();
+#endif
 
-		timer_set_oc_value(TIM1, TIM_OC2, gamma16[brightness_warm * TIMER_TOP / 1000]);
-		timer_set_oc_value(TIM1, TIM_OC3, gamma16[brightness_cold * TIMER_TOP / 1000]);
-/*
-		timer_set_oc_value(TIM1, TIM_OC2, brightness_warm * TIMER_TOP / 100);
-		timer_set_oc_value(TIM1, TIM_OC3, brightness_cold * TIMER_TOP / 100);
-*/
+		light_update();
 	}
 
 	return 0;
@@ -5,11 +5,12 @@
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/timer.h>
 
-#define OS_TIMER TIM3
-#define OS_TIMER_RCC RCC_TIM3
-#define OS_TIMER_RST RST_TIM3
-#define OS_TIMER_IRQ NVIC_TIM3_IRQ
-#define OS_TIMER_IRQ_HANDLER tim3_isr
+// TIM14, TIM3 is the only spare timer with an encoder interface
+#define OS_TIMER TIM14
+#define OS_TIMER_RCC RCC_TIM14
+#define OS_TIMER_RST RST_TIM14
+#define OS_TIMER_IRQ NVIC_TIM14_IRQ
+#define OS_TIMER_IRQ_HANDLER tim14_isr
 #define OS_TIMER_TOP (0xFFFF)
 
 static uint32_t last_timer_counter_sync = 0;
@@ -38,25 +39,15 @@ static void os_sync_time(void) {
 	uint32_t ticks_delta;
 
 	/*
-	 * TODO : This is slightly flawed.
-	 * if overflow happens and is checked too late
-	 * it might not be caught. Add an additional
-	 * overflow flag set from isr.
-	 * Then check for the flag both, when overflow
-	 * is detected and even if not. The check within
-	 * the detection needs to have interrupts disabled
-	 * and must set an additional overflow_handled flag
-	 * to prevent races with the isr.
-	 * The check outside is less critical. It can just
-	 * check the flag and unset it if it was set. In theory
-	 * there could be a race against the next overflow.
-	 * However we assume that overflows are far enough apart
-	 * for this routine to handle the first before another
-	 * one happens
+	 * An overflow is only seen as the counter going backwards, this
+	 * must run at least once per timer period. Syncs right after
+	 * every overflow alone would find the counter where it was one
+	 * period ago and miss that period. os_run() syncs once half a
+	 * period has passed.
 	 */
 	if (ticks_now < last_timer_counter_sync) {
 		// Overflow happened!
-		ticks_delta = OS_TIMER_TOP;
+		ticks_delta = OS_TIMER_TOP + 1;
 		ticks_delta -= last_timer_counter_sync;
 		ticks_delta += ticks_now;
 	} else {
@@ -156,6 +147,23 @@ void os_schedule_task_relative(os_task_t *task, os_task_f cb, uint32_t us, void
 	os_recalculate_next_deadline();
 }
 
+void os_cancel_task(os_task_t *task) {
+	os_remove_task(task);
+	os_recalculate_next_deadline();
+}
+
+bool os_task_pending(os_task_t *task) {
+	os_task_t *cursor = os_tasks;
+
+	while (cursor) {
+		if (cursor == task) {
+			return true;
+		}
+		cursor = cursor->next;
+	}
+	return false;
+}
+
 void os_run() {
 	uint32_t ticks_now = timer_get_counter(OS_TIMER);
 	os_task_t *task = os_tasks;
@@ -163,16 +171,23 @@ void os_run() {
 
 	if (ticks_now > last_run_timer_counter) {
 		// Fast path
+		if (ticks_now > last_timer_counter_sync + OS_TIMER_TOP / 2) {
+			os_sync_time();
+		}
 		if (ticks_now < next_task_timer_counter) {
 			last_run_timer_counter = ticks_now;
 			return;
-		} else {
+		} else if (next_task_timer_counter != OS_TIMER_TOP) {
 			// Ensure minimum latency by executing deadline task first
 			if (task) {
 				os_remove_task(task);
 				task->run(task->ctx);
 			}
 		}
+		/*
+		 * OS_TIMER_TOP also stands for a deadline beyond the
+		 * overflow, the slow path checks it against the time
+		 */
 	}
 	// slow path
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -18,13 +19,17 @@ struct os_task {
 	void *ctx;
 	os_time_t deadline;
 	os_task_f run;
+	// Resume point of coroutine tasks, see os_coro.h
+	uint16_t coro_line;
 };
 
-#define OS_TASK_INITIALIZER { NULL, NULL, OS_TIME_INITIALIZER, NULL }
+#define OS_TASK_INITIALIZER { NULL, NULL, OS_TIME_INITIALIZER, NULL, 0 }
 
 typedef struct os_task os_task_t;
 
 void os_init(void);
 void os_schedule_task_relative(os_task_t *task, os_task_f cb, uint32_t us, void *ctx);
+void os_cancel_task(os_task_t *task);
+bool os_task_pending(os_task_t *task);
 void os_run(void);
 void os_delay(uint32_t us);
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "os.h"
+
+/*
+ * Stackless coroutines on top of os_task_t
+ *
+ * A coroutine is a plain os_task_f with its body wrapped in
+ * OS_CORO_BEGIN()/OS_CORO_END(). The only state kept across an
+ * await is the resume point in task->coro_line. Locals are lost
+ * on every await, anything that must survive has to live in ctx.
+ * Resume points are case labels, thus a coroutine body must not
+ * contain switch statements of its own and only one await per
+ * source line is possible.
+ *
+ * Example:
+ *	static void fade_cb(void *ctx) {
+ *		fade_t *fade = ctx;
+ *
+ *		OS_CORO_BEGIN(&fade->task);
+ *		for (fade->step = 0; fade->step < 10; fade->step++) {
+ *			...
+ *			OS_CORO_AWAIT_DELAY(&fade->task, MS_TO_US(20));
+ *		}
+ *		OS_CORO_END(&fade->task);
+ *	}
+ *
+ *	os_coro_start(&fade->task, fade_cb, fade);
+ */
+
+#define OS_CORO_BEGIN(task) \
+	switch ((task)->coro_line) { \
+	case 0:
+
+#define OS_CORO_END(task) \
+	} \
+	(task)->coro_line = 0
+
+// Leave the coroutine, it will not be resumed until restarted
+#define OS_CORO_EXIT(task) \
+	do { \
+		(task)->coro_line = 0; \
+		return; \
+	} while (0)
+
+// Resume after at least us microseconds
+#define OS_CORO_AWAIT_DELAY(task, us) \
+	do { \
+		(task)->coro_line = __LINE__; \
+		os_schedule_task_relative((task), (task)->run, (us), (task)->ctx); \
+		return; \
+	case __LINE__:; \
+	} while (0)
+
+// Let other tasks run, resume on the next os_run() pass
+#define OS_CORO_YIELD(task) OS_CORO_AWAIT_DELAY(task, 1)
+
+// Check cond every poll_us (> 0) microseconds, resume once it is true
+#define OS_CORO_AWAIT_UNTIL(task, cond, poll_us) \
+	do { \
+		__attribute__((fallthrough)); \
+	case __LINE__: \
+		if (!(cond)) { \
+			(task)->coro_line = __LINE__; \
+			os_schedule_task_relative((task), (task)->run, (poll_us), (task)->ctx); \
+			return; \
+		} \
+	} while (0)
+
+// Resume once the task or coroutine other has finished
+#define OS_CORO_AWAIT_TASK(task, other, poll_us) \
+	OS_CORO_AWAIT_UNTIL(task, !os_coro_running(other), poll_us)
+
+static inline void os_coro_start(os_task_t *task, os_task_f cb, void *ctx) {
+	task->coro_line = 0;
+	os_schedule_task_relative(task, cb, 0, ctx);
+}
+
+static inline void os_coro_stop(os_task_t *task) {
+	os_cancel_task(task);
+	task->coro_line = 0;
+}
+
+static inline bool os_coro_running(os_task_t *task) {
+	return task->coro_line || os_task_pending(task);
+}
@@ -0,0 +1,185 @@
+#include "pwm.h"
+
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+
+#include "diag.h"
+#include "isr.h"
+#include "util.h"
+
+#if PWM_INTERLEAVED
+#define PWM_ALIGNMENT TIM_CR1_CMS_CENTER_1
+#define PWM_OCM_COLD TIM_OCM_PWM2
+// Update events happen on both overflow and underflow
+#define PWM_UPDATE_TICKS PWM_TOP
+#define PWM_TICKS(top) (2 * (uint32_t)(top))
+#else
+#define PWM_ALIGNMENT TIM_CR1_CMS_EDGE
+#define PWM_OCM_COLD TIM_OCM_PWM1
+#define PWM_UPDATE_TICKS (PWM_TOP + 1)
+#define PWM_TICKS(top) ((uint32_t)(top) + 1)
+#endif
+
+#define PWM_DEFAULT 0
+
+static bool pwm_lit = false;
+static uint16_t pwm_top = PWM_TOP;
+static uint16_t duty_warm = PWM_DEFAULT;
+static uint16_t duty_cold = PWM_DEFAULT;
+static volatile uint8_t slew_updates = 0;
+
+static uint32_t pwm_prescaler(void) {
+	return rcc_apb1_frequency / PWM_TIMER_FREQ - 1;
+}
+
+static void pwm_load_duty(uint16_t warm, uint16_t cold) {
+	duty_warm = warm;
+	duty_cold = cold;
+	if (pwm_top != PWM_TOP) {
+		warm = (uint32_t)warm * pwm_top / PWM_TOP;
+		cold = (uint32_t)cold * pwm_top / PWM_TOP;
+	}
+
+	timer_set_oc_value(TIM1, TIM_OC2, warm);
+#if PWM_INTERLEAVED
+	/*
+	 * PWM2 is active from the compare value up to the peak and
+	 * back down again. Above the top it is never active.
+	 */
+	timer_set_oc_value(TIM1, TIM_OC3, cold ? pwm_top - cold : pwm_top + 1);
+#else
+	timer_set_oc_value(TIM1, TIM_OC3, cold);
+#endif
+}
+
+// Starts with the given duties from the very first period on
+void pwm_init(uint16_t warm, uint16_t cold) {
+	rcc_periph_clock_enable(RCC_TIM1);
+	rcc_periph_reset_pulse(RST_TIM1);
+
+	timer_set_mode(TIM1, TIM_CR1_CKD_CK_INT, PWM_ALIGNMENT, TIM_CR1_DIR_UP);
+	// Might still be running from HSI, see pwm_clock_update()
+	timer_set_prescaler(TIM1, pwm_prescaler());
+	// Period might be changed at runtime, see pwm_set_top()
+	timer_enable_preload(TIM1);
+	timer_continuous_mode(TIM1);
+	timer_set_period(TIM1, PWM_TOP);
+	timer_enable_break_main_output(TIM1);
+	timer_update_on_overflow(TIM1);
+	timer_set_oc_mode(TIM1, TIM_OC2, TIM_OCM_PWM1);
+	timer_set_oc_mode(TIM1, TIM_OC3, PWM_OCM_COLD);
+#if PWM_INTERLEAVED
+	/*
+	 * Both compare values take effect together, and together with a
+	 * new period, on the next update event. Those come at the valley
+	 * and at the peak, the centres of the warm and cold pulses. The
+	 * pulse around it has its first half at the old and its second
+	 * half at the new duty, both halves of the other channel's pulse
+	 * are at the new one.
+	 */
+	timer_enable_oc_preload(TIM1, TIM_OC2);
+	timer_enable_oc_preload(TIM1, TIM_OC3);
+#endif
+	pwm_load_duty(warm, cold);
+	// Load the preloaded prescaler and compare values before starting
+	timer_generate_event(TIM1, TIM_EGR_UG);
+	// Not before, PWM2 with the reset compare value of 0 is always on
+	timer_enable_oc_output(TIM1, TIM_OC2);
+	timer_enable_oc_output(TIM1, TIM_OC3);
+	// The compare values are active since the UG, outputs switch right away
+	if (warm || cold) {
+		diag_boot_lit();
+		pwm_lit = true;
+	}
+	// Same priority as the sync bus to avoid racing pwm_slew()
+	nvic_set_priority(NVIC_TIM1_BRK_UP_TRG_COM_IRQ, ISR_PRIO_HIGH);
+	nvic_enable_irq(NVIC_TIM1_BRK_UP_TRG_COM_IRQ);
+	timer_enable_counter(TIM1);
+}
+
+// Must be called after changing the APB clock
+void pwm_clock_update(void) {
+	timer_set_prescaler(TIM1, pwm_prescaler());
+}
+
+// Duties are always given in units of 1 / PWM_TOP
+void pwm_set_duty(uint16_t warm, uint16_t cold) {
+	// Dark at boot, lit from the next update event on
+	if (!pwm_lit && (warm || cold)) {
+		diag_boot_lit();
+		pwm_lit = true;
+	}
+	pwm_load_duty(warm, cold);
+}
+
+// Change the period, duties are rescaled to keep brightness unchanged
+void pwm_set_top(uint16_t top) {
+	pwm_top = top;
+	timer_set_period(TIM1, top);
+	pwm_load_duty(duty_warm, duty_cold);
+}
+
+// Restart the PWM period on every edge of a timer trigger input
+void pwm_external_reset(bool enable, uint8_t trigger) {
+	if (enable) {
+		timer_slave_set_trigger(TIM1, trigger);
+		timer_slave_set_mode(TIM1, TIM_SMCR_SMS_RM);
+	} else {
+		timer_slave_set_mode(TIM1, TIM_SMCR_SMS_OFF);
+	}
+}
+
+/*
+ * Position within the current period, 0 at the counter valley. Always
+ * in ticks of the nominal period, 0 to PWM_PERIOD - 1, also while
+ * pwm_set_top() has changed the period.
+ */
+uint16_t pwm_get_phase(void) {
+	uint32_t phase = timer_get_counter(TIM1);
+	uint32_t period = PWM_TICKS(pwm_top);
+
+#if PWM_INTERLEAVED
+	if (TIM_CR1(TIM1) & TIM_CR1_DIR_DOWN) {
+		// The valley may still read as counting down, that is 0 not period
+		phase = (period - phase) % period;
+	}
+#endif
+	if (period != PWM_PERIOD) {
+		phase = phase * PWM_PERIOD / period;
+	}
+	return phase;
+}
+
+// Phase shift in timer ticks per update event of slewing
+uint16_t pwm_slew_step(void) {
+	return PWM_UPDATE_TICKS / (pwm_prescaler() + 1);
+}
+
+/*
+ * Shift the phase by running the timer slightly faster (updates > 0)
+ * or slower (updates < 0) for the given number of update events.
+ * Duties are unaffected, only the period changes meanwhile.
+ */
+void pwm_slew(int8_t updates) {
+	uint32_t prescaler = pwm_prescaler();
+
+	if (!updates) {
+		return;
+	}
+
+	slew_updates = ABS(updates);
+	// Prescaler is preloaded, takes effect on the next update event
+	timer_set_prescaler(TIM1, updates > 0 ? prescaler - 1 : prescaler + 1);
+	timer_clear_flag(TIM1, TIM_SR_UIF);
+	timer_enable_irq(TIM1, TIM_DIER_UIE);
+}
+
+void tim1_brk_up_trg_com_isr(void) {
+	timer_clear_flag(TIM1, TIM_SR_UIF);
+	if (slew_updates && --slew_updates) {
+		return;
+	}
+	timer_set_prescaler(TIM1, pwm_prescaler());
+	timer_disable_irq(TIM1, TIM_DIER_UIE);
+}
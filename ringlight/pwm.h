@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "util.h"
+
+#define PWM_TOP 1000
+
+/*
+ * Warm and cold channel currents add up at the supply. In edge
+ * aligned mode both channels switch on at the start of every
+ * period and their peaks stack.
+ * In interleaved mode the timer counts up and down. The warm
+ * channel (PWM1) is on around the counter valley, the cold channel
+ * (PWM2) around the peak, half a period later. Thus the on times
+ * only overlap if the duties add up to more than PWM_TOP and then
+ * only by the excess.
+ */
+#ifndef PWM_INTERLEAVED
+#define PWM_INTERLEAVED 1
+#endif
+
+#if PWM_INTERLEAVED
+// Counting up and down takes 2 * PWM_TOP ticks per period
+#define PWM_TIMER_FREQ MHZ(2)
+#define PWM_PERIOD (2 * PWM_TOP)
+#else
+#define PWM_TIMER_FREQ MHZ(1)
+#define PWM_PERIOD (PWM_TOP + 1)
+#endif
+
+void pwm_init(uint16_t warm, uint16_t cold);
+void pwm_clock_update(void);
+void pwm_set_duty(uint16_t warm, uint16_t cold);
+void pwm_set_top(uint16_t top);
+void pwm_external_reset(bool enable, uint8_t trigger);
+uint16_t pwm_get_phase(void);
+uint16_t pwm_slew_step(void);
+void pwm_slew(int8_t updates);
@@ -0,0 +1,134 @@
+#include "shutter.h"
+
+#if SHUTTER_ENABLE
+
+#if ENCODER_ENABLE
+#error "Shutter sync and encoder both require TIM3"
+#endif
+#if SYNC_MODE
+#error "Shutter sync and sync bus both control the PWM phase"
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+
+#include "diag.h"
+#include "os.h"
+#include "pwm.h"
+#include "util.h"
+
+/*
+ * Camera shutter sync
+ *
+ * TIM3 measures the period of the camera frame signal on its CH2
+ * input. It is reset on every rising edge and passes the reset on
+ * to TIM1 via TRGO, restarting the PWM period in lock step with
+ * the frame. The PWM period is chosen as an integer divisor of the
+ * frame period close to the nominal one, so every frame sees the
+ * same number of whole PWM periods.
+ *
+ * The first capture after the signal (re)appears is the time since
+ * the last overflow, not a frame period. Only polls that saw two
+ * captures are used, that takes 20 fps or more.
+ */
+#define SHUTTER_TIMER TIM3
+#define SHUTTER_TIMER_RCC RCC_TIM3
+#define SHUTTER_TIMER_RST RST_TIM3
+#define SHUTTER_TIMER_FREQ MHZ(1)
+// TIM3 TRGO is internal trigger 2 of TIM1
+#define SHUTTER_PWM_TRIGGER TIM_SMCR_TS_ITR2
+
+#define SHUTTER_POLL_MS 100
+// Frame period changes below this are considered jitter
+#define SHUTTER_TOLERANCE_US 4
+// PWM_PERIOD is given in PWM timer ticks
+#define SHUTTER_PWM_PERIOD_US (PWM_PERIOD / (PWM_TIMER_FREQ / MHZ(1)))
+
+static os_task_t shutter_task = OS_TASK_INITIALIZER;
+// Frame period the PWM is locked to, 0 if unlocked
+static uint16_t locked_us = 0;
+static bool ever_locked = false;
+
+static void shutter_unlock(void) {
+	pwm_external_reset(false, 0);
+	pwm_set_top(PWM_TOP);
+	locked_us = 0;
+	diag_g.shutter_period_us = 0;
+	diag_g.shutter_divisor = 0;
+}
+
+static void shutter_lock(uint16_t period_us) {
+	uint8_t divisor = MAX((period_us + SHUTTER_PWM_PERIOD_US / 2) / SHUTTER_PWM_PERIOD_US, 1);
+	uint32_t pwm_period = (uint32_t)period_us * (PWM_TIMER_FREQ / MHZ(1)) / divisor;
+
+	/*
+	 * Rounding down makes the last PWM period before each frame
+	 * edge a little longer. It is the same in every frame though.
+	 */
+	pwm_set_top(pwm_period * PWM_TOP / PWM_PERIOD);
+	pwm_external_reset(true, SHUTTER_PWM_TRIGGER);
+	locked_us = period_us;
+	if (ever_locked) {
+		diag_g.shutter_relocks++;
+	}
+	ever_locked = true;
+	diag_g.shutter_period_us = period_us;
+	diag_g.shutter_divisor = divisor;
+}
+
+static void shutter_task_cb(void *ctx) {
+	// Overflow, no frame edge for more than 65ms
+	bool lost = timer_get_flag(SHUTTER_TIMER, TIM_SR_UIF);
+	bool captured = timer_get_flag(SHUTTER_TIMER, TIM_SR_CC2IF);
+	// Captured again since, CCR2 spans a whole frame
+	bool captured_twice = timer_get_flag(SHUTTER_TIMER, TIM_SR_CC2OF);
+	uint16_t period_us = TIM_CCR2(SHUTTER_TIMER);
+
+	(void)ctx;
+
+	os_schedule_task_relative(&shutter_task, shutter_task_cb, MS_TO_US(SHUTTER_POLL_MS), NULL);
+	timer_clear_flag(SHUTTER_TIMER, TIM_SR_UIF | TIM_SR_CC2IF | TIM_SR_CC2OF);
+
+	if (lost && !captured) {
+		if (locked_us) {
+			shutter_unlock();
+		}
+		return;
+	}
+	if (!captured_twice || lost) {
+		return;
+	}
+
+	if (ABS(period_us - locked_us) > SHUTTER_TOLERANCE_US) {
+		shutter_lock(period_us);
+	} else {
+		diag_g.shutter_jitter_us = MAX(diag_g.shutter_jitter_us, ABS(period_us - locked_us));
+	}
+}
+
+void shutter_init(void) {
+	rcc_periph_clock_enable(SHUTTER_TIMER_RCC);
+	rcc_periph_reset_pulse(SHUTTER_TIMER_RST);
+
+	timer_set_prescaler(SHUTTER_TIMER, rcc_apb1_frequency / SHUTTER_TIMER_FREQ - 1);
+	timer_set_period(SHUTTER_TIMER, 0xFFFF);
+	// Trigger resets must not set the update flag, only overflows
+	timer_update_on_overflow(SHUTTER_TIMER);
+	timer_ic_set_input(SHUTTER_TIMER, TIM_IC2, TIM_IC_IN_TI2);
+	timer_ic_set_filter(SHUTTER_TIMER, TIM_IC2, TIM_IC_CK_INT_N_8);
+	timer_ic_set_polarity(SHUTTER_TIMER, TIM_IC2, TIM_IC_RISING);
+	timer_ic_enable(SHUTTER_TIMER, TIM_IC2);
+	timer_slave_set_trigger(SHUTTER_TIMER, TIM_SMCR_TS_TI2FP2);
+	timer_slave_set_mode(SHUTTER_TIMER, TIM_SMCR_SMS_RM);
+	timer_set_master_mode(SHUTTER_TIMER, TIM_CR2_MMS_RESET);
+	timer_generate_event(SHUTTER_TIMER, TIM_EGR_UG);
+	timer_clear_flag(SHUTTER_TIMER, TIM_SR_UIF | TIM_SR_CC2IF | TIM_SR_CC2OF);
+	timer_enable_counter(SHUTTER_TIMER);
+
+	os_schedule_task_relative(&shutter_task, shutter_task_cb, MS_TO_US(SHUTTER_POLL_MS), NULL);
+}
+
+#endif
@@ -0,0 +1,3 @@
+#pragma once
+
+void shutter_init(void);
@@ -0,0 +1,270 @@
+#include "sync.h"
+
+#if SYNC_MODE != SYNC_MODE_OFF
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/usart.h>
+
+#include "isr.h"
+#include "os.h"
+#include "pwm.h"
+#include "util.h"
+#include "velocity.h"
+
+/*
+ * Multi-lamp synchronisation over a single wire half-duplex UART
+ *
+ * The leader broadcasts its brightness and temperature every
+ * SYNC_INTERVAL_MS. Each frame also carries the PWM phase of the
+ * leader at the moment transmission started. Followers apply the
+ * state and slew their PWM towards the leaders phase.
+ *
+ * Slewing only removes the phase error seen at each frame. Any HSI
+ * frequency mismatch between leader and follower drifts the phase
+ * again until the next frame, 1% is ~400 of the 2000 ticks period
+ * per interval. Followers therefore also learn a PWM period trim
+ * from the drift between successive frames. ARR steps are 0.1% of
+ * the period, the residual of up to 0.05% (~20 ticks per interval)
+ * is left to the slewing. Errors below half a slew step, ~20 ticks,
+ * are not corrected either.
+ *
+ * Frame layout:
+ *	0	SYNC_START
+ *	1..3	brightness (bits 0-9), temperature (bits 10-19), LSB first
+ *	4..5	leader PWM phase, LSB first
+ *	6	two's complement of the sum of bytes 1..5
+ */
+#define SYNC_USART USART1
+#define SYNC_USART_RCC RCC_USART1
+#define SYNC_USART_RST RST_USART1
+#define SYNC_USART_IRQ NVIC_USART1_IRQ
+#define SYNC_BAUDRATE 500000
+
+#define SYNC_INTERVAL_MS 20
+// Nominal PWM timer ticks between two frames
+#define SYNC_INTERVAL_TICKS ((int32_t)(SYNC_INTERVAL_MS * (PWM_TIMER_FREQ / KHZ(1))))
+#define SYNC_START 0xA5
+#define SYNC_FRAME_LEN 7
+#define SYNC_BIT_TICKS (PWM_TIMER_FREQ / SYNC_BAUDRATE)
+/*
+ * Start of the first byte to reception of the last one. 10 bits per
+ * byte, RXNE is set when the middle of the last stop bit is sampled.
+ */
+#define SYNC_FRAME_TICKS (SYNC_FRAME_LEN * 10 * SYNC_BIT_TICKS - SYNC_BIT_TICKS / 2)
+
+static volatile uint8_t frame_g[SYNC_FRAME_LEN];
+static volatile uint8_t frame_pos = 0;
+
+static uint8_t sync_checksum(volatile uint8_t *frame) {
+	uint8_t sum = 0;
+	unsigned i;
+
+	for (i = 1; i < SYNC_FRAME_LEN - 1; i++) {
+		sum += frame[i];
+	}
+	return -sum;
+}
+
+#if SYNC_MODE == SYNC_MODE_LEADER
+
+static os_task_t sync_task = OS_TASK_INITIALIZER;
+
+static void sync_task_cb(void *ctx) {
+	uint32_t state = velocity_get_value(VELOCITY_BRIGHTNESS);
+	uint16_t phase;
+
+	(void)ctx;
+
+	os_schedule_task_relative(&sync_task, sync_task_cb, MS_TO_US(SYNC_INTERVAL_MS), NULL);
+
+	// Previous frame still in flight
+	if (frame_pos) {
+		return;
+	}
+
+	state |= (uint32_t)velocity_get_value(VELOCITY_TEMPERATURE) << 10;
+	frame_g[0] = SYNC_START;
+	frame_g[1] = state;
+	frame_g[2] = state >> 8;
+	frame_g[3] = state >> 16;
+
+	// Phase stamp must match the start of transmission as close as possible
+	cm_disable_interrupts();
+	phase = pwm_get_phase();
+	frame_g[4] = phase;
+	frame_g[5] = phase >> 8;
+	frame_g[6] = sync_checksum(frame_g);
+	usart_send(SYNC_USART, frame_g[0]);
+	frame_pos = 1;
+	usart_enable_tx_interrupt(SYNC_USART);
+	cm_enable_interrupts();
+}
+
+void sync_update(void) {
+}
+
+void usart1_isr(void) {
+	if (!usart_get_flag(SYNC_USART, USART_ISR_TXE)) {
+		return;
+	}
+
+	if (frame_pos < SYNC_FRAME_LEN) {
+		usart_send(SYNC_USART, frame_g[frame_pos++]);
+	} else {
+		usart_disable_tx_interrupt(SYNC_USART);
+		frame_pos = 0;
+	}
+}
+
+#else
+
+// Largest period trim, the HSI is only specified to 1% at 25 degrees
+#define SYNC_TRIM_MAX (PWM_TOP / 20)
+// Fixed point fraction bits of the trim
+#define SYNC_TRIM_SHIFT 8
+
+static volatile uint32_t rx_state;
+static volatile uint16_t rx_top = PWM_TOP;
+static volatile bool rx_pending = false;
+
+// Previous frame's phase error and the slew applied against it
+static bool prev_valid = false;
+static int16_t prev_error;
+static int16_t prev_slew;
+// PWM_TOP offset in 1 / (1 << SYNC_TRIM_SHIFT)
+static int32_t trim = 0;
+
+// Shortest way round
+static int32_t sync_wrap(int32_t error) {
+	if (error > PWM_PERIOD / 2) {
+		error -= PWM_PERIOD;
+	} else if (error <= -PWM_PERIOD / 2) {
+		error += PWM_PERIOD;
+	}
+	return error;
+}
+
+/*
+ * Whatever part of the error the previous slew does not explain has
+ * drifted in since, integrate it into the period trim. Only half of
+ * it each time, a lost frame doubles the apparent drift.
+ */
+static void sync_follow_frequency(int32_t error) {
+	int32_t drift = sync_wrap(error - (prev_error - prev_slew));
+
+	// Positive drift, we are slow and need a shorter period
+	trim -= drift * PWM_TOP * (1 << SYNC_TRIM_SHIFT) / SYNC_INTERVAL_TICKS / 2;
+	trim = MIN(trim, SYNC_TRIM_MAX << SYNC_TRIM_SHIFT);
+	trim = MAX(trim, -(SYNC_TRIM_MAX << SYNC_TRIM_SHIFT));
+	rx_top = PWM_TOP + (trim + (trim > 0 ? 1 : -1) * (1 << (SYNC_TRIM_SHIFT - 1))) / (1 << SYNC_TRIM_SHIFT);
+}
+
+static void sync_follow_phase(uint16_t leader_phase, uint16_t phase) {
+	int32_t error = sync_wrap((int32_t)(leader_phase + SYNC_FRAME_TICKS) % PWM_PERIOD - phase);
+	uint16_t step = pwm_slew_step();
+	int8_t updates;
+
+	if (prev_valid) {
+		sync_follow_frequency(error);
+	}
+
+	// Positive error, leader is ahead of us
+	updates = (error + (error > 0 ? step / 2 : -(step / 2))) / step;
+	pwm_slew(updates);
+
+	prev_error = error;
+	prev_slew = updates * step;
+	prev_valid = true;
+}
+
+// Apply state received from the leader, overrides local controls
+void sync_update(void) {
+	static uint16_t top = PWM_TOP;
+	uint32_t state;
+
+	if (!rx_pending) {
+		return;
+	}
+
+	cm_disable_interrupts();
+	state = rx_state;
+	rx_pending = false;
+	cm_enable_interrupts();
+
+	// Here rather than in the ISR, pwm_set_top() races light_update()
+	if (rx_top != top) {
+		top = rx_top;
+		pwm_set_top(top);
+	}
+	velocity_set_value(VELOCITY_BRIGHTNESS, state & 0x3ff);
+	velocity_set_value(VELOCITY_TEMPERATURE, (state >> 10) & 0x3ff);
+}
+
+void usart1_isr(void) {
+	// Sample as early as possible, timing reference for the last byte
+	uint16_t phase = pwm_get_phase();
+	uint8_t data;
+
+	if (usart_get_flag(SYNC_USART, USART_ISR_ORE) || usart_get_flag(SYNC_USART, USART_ISR_FE)) {
+		USART_ICR(SYNC_USART) = USART_ICR_ORECF | USART_ICR_FECF;
+		frame_pos = 0;
+	}
+
+	if (!usart_get_flag(SYNC_USART, USART_ISR_RXNE)) {
+		return;
+	}
+
+	data = usart_recv(SYNC_USART);
+	if (!frame_pos && data != SYNC_START) {
+		return;
+	}
+
+	frame_g[frame_pos++] = data;
+	if (frame_pos < SYNC_FRAME_LEN) {
+		return;
+	}
+	frame_pos = 0;
+
+	if (sync_checksum(frame_g) != frame_g[SYNC_FRAME_LEN - 1]) {
+		return;
+	}
+
+	sync_follow_phase(frame_g[4] | frame_g[5] << 8, phase);
+	rx_state = frame_g[1] | frame_g[2] << 8 | (uint32_t)frame_g[3] << 16;
+	rx_pending = true;
+}
+
+#endif
+
+void sync_init(void) {
+	rcc_periph_clock_enable(SYNC_USART_RCC);
+	rcc_periph_reset_pulse(SYNC_USART_RST);
+
+	usart_set_baudrate(SYNC_USART, SYNC_BAUDRATE);
+	usart_set_databits(SYNC_USART, 8);
+	usart_set_stopbits(SYNC_USART, USART_STOPBITS_1);
+	usart_set_parity(SYNC_USART, USART_PARITY_NONE);
+	usart_set_flow_control(SYNC_USART, USART_FLOWCONTROL_NONE);
+	// Single wire, TX pin is used for both directions
+	USART_CR3(SYNC_USART) |= USART_CR3_HDSEL;
+
+	nvic_set_priority(SYNC_USART_IRQ, ISR_PRIO_HIGH);
+	nvic_enable_irq(SYNC_USART_IRQ);
+
+#if SYNC_MODE == SYNC_MODE_LEADER
+	usart_set_mode(SYNC_USART, USART_MODE_TX);
+	usart_enable(SYNC_USART);
+	os_schedule_task_relative(&sync_task, sync_task_cb, MS_TO_US(SYNC_INTERVAL_MS), NULL);
+#else
+	usart_set_mode(SYNC_USART, USART_MODE_RX);
+	usart_enable_rx_interrupt(SYNC_USART);
+	usart_enable(SYNC_USART);
+#endif
+}
+
+#endif
@@ -0,0 +1,8 @@
+#pragma once
+
+#define SYNC_MODE_OFF 0
+#define SYNC_MODE_LEADER 1
+#define SYNC_MODE_FOLLOWER 2
+
+void sync_init(void);
+void sync_update(void);
@@ -3,6 +3,7 @@
 
 #include "button.h"
 #include "os.h"
+#include "os_coro.h"
 #include "util.h"
 #include "velocity.h"
 
@@ -10,95 +11,115 @@
 #define VELOCITY_FRACTION 1000
 
 typedef struct {
-	unsigned button_inc;
-	unsigned button_dec;
-	int min;
-	int max;
-	int step;
+	uint8_t button_inc;
+	uint8_t button_dec;
+	int16_t min;
+	int16_t max;
+	int16_t step;
 	uint32_t acceleration; // 1/1000 units per second
 	uint32_t default_speed; // 1/1000 units per second
 	uint32_t max_speed; // speed limit
+} velocity_control_t;
+
+typedef struct {
+	int32_t value;
 	uint32_t current_speed;
 	bool inc_pressed;
 	bool dec_pressed;
-	int32_t value;
 	os_task_t update_task;
-} velocity_control_t;
+} velocity_state_t;
 
-#define VELOCITY_CONTROL(btn_up, btn_down, min, max, step, accel, default_speed, max_speed, default) \
-	{ btn_up, btn_down, min, max, step, accel, default_speed, max_speed, default_speed, false, false, default * VELOCITY_FRACTION, OS_TASK_INITIALIZER }
+#define VELOCITY_CONTROL(btn_up, btn_down, min, max, step, accel, default_speed, max_speed) \
+	{ btn_up, btn_down, min, max, step, accel, default_speed, max_speed }
 
-static velocity_control_t controls_g[] = {
-	VELOCITY_CONTROL(BUTTON_BRIGHTER, BUTTON_DIMMER, 0, 1000, 10, 1000, 20000, 100000, 10),
-	VELOCITY_CONTROL(BUTTON_WARMER, BUTTON_COOLER, 0, 1000, 10, 1000, 20000, 100000, 500),
+#define VELOCITY_STATE(default) \
+	{ default * VELOCITY_FRACTION, 0, false, false, OS_TASK_INITIALIZER }
+
+static const velocity_control_t controls_g[] = {
+	VELOCITY_CONTROL(BUTTON_BRIGHTER, BUTTON_DIMMER, 0, 1000, 10, 1000, 20000, 100000),
+	VELOCITY_CONTROL(BUTTON_WARMER, BUTTON_COOLER, 0, 1000, 10, 1000, 20000, 100000),
+};
+
+// Same order as controls_g, boot defaults must give a non-zero duty after gamma
+static velocity_state_t states_g[] = {
+	VELOCITY_STATE(VELOCITY_BRIGHTNESS_DEFAULT),
+	VELOCITY_STATE(VELOCITY_TEMPERATURE_DEFAULT),
 };
 
 int velocity_get_value(unsigned velocity_id) {
-	velocity_control_t *velocity = &controls_g[velocity_id];
+	velocity_state_t *state = &states_g[velocity_id];
 
-	return velocity->value / VELOCITY_FRACTION;
+	return state->value / VELOCITY_FRACTION;
 }
 
 void velocity_set_value(unsigned velocity_id, int value) {
-	velocity_control_t *velocity = &controls_g[velocity_id];
+	const velocity_control_t *velocity = &controls_g[velocity_id];
+	velocity_state_t *state = &states_g[velocity_id];
 
-	velocity->value = value * VELOCITY_FRACTION;
+	value = MIN(value, velocity->max);
+	value = MAX(value, velocity->min);
+	state->value = value * VELOCITY_FRACTION;
 }
 
 bool velocity_both_pressed(unsigned velocity_id) {
-	velocity_control_t *velocity = &controls_g[velocity_id];
+	velocity_state_t *state = &states_g[velocity_id];
 
-	return velocity->inc_pressed && velocity->dec_pressed;
+	return state->inc_pressed && state->dec_pressed;
 }
 
+// Ramps the value while a button is held, restarted on every press
 static void velocity_task_cb(void *ctx) {
-	velocity_control_t *velocity = ctx;
+	velocity_state_t *state = ctx;
+	const velocity_control_t *velocity = &controls_g[state - states_g];
 
-	if (velocity->inc_pressed || velocity->dec_pressed) {
-		os_schedule_task_relative(&velocity->update_task, velocity_task_cb, MS_TO_US(1000 / UPDATE_INTERVAL_MS), velocity);
-	}
+	OS_CORO_BEGIN(&state->update_task);
+	while (state->inc_pressed || state->dec_pressed) {
+		OS_CORO_AWAIT_DELAY(&state->update_task, MS_TO_US(1000 / UPDATE_INTERVAL_MS));
 
-	if (velocity->inc_pressed) {
-		velocity->value += velocity->current_speed / (1000 / UPDATE_INTERVAL_MS);
-	}
+		if (state->inc_pressed) {
+			state->value += state->current_speed / (1000 / UPDATE_INTERVAL_MS);
+		}
 
-	if (velocity->dec_pressed) {
-		velocity->value -= velocity->current_speed / (1000 / UPDATE_INTERVAL_MS);
-	}
+		if (state->dec_pressed) {
+			state->value -= state->current_speed / (1000 / UPDATE_INTERVAL_MS);
+		}
 
-	velocity->value = MIN(velocity->value, velocity->max * VELOCITY_FRACTION);
-	velocity->value = MAX(velocity->value, velocity->min * VELOCITY_FRACTION);
+		state->value = MIN(state->value, velocity->max * VELOCITY_FRACTION);
+		state->value = MAX(state->value, velocity->min * VELOCITY_FRACTION);
 
-	velocity->current_speed += velocity->acceleration / (1000 / UPDATE_INTERVAL_MS);
-	velocity->current_speed = MIN(velocity->current_speed, velocity->max_speed);
+		state->current_speed += velocity->acceleration / (1000 / UPDATE_INTERVAL_MS);
+		state->current_speed = MIN(state->current_speed, velocity->max_speed);
+	}
+	OS_CORO_END(&state->update_task);
 }
 
 void velocity_update(void) {
 	unsigned i;
 
 	for (i = 0; i < ARRAY_SIZE(controls_g); i++) {
-		velocity_control_t *velocity = &controls_g[i];
+		const velocity_control_t *velocity = &controls_g[i];
+		velocity_state_t *state = &states_g[i];
 		bool inc_pressed = button_get_state(velocity->button_inc);
 		bool dec_pressed = button_get_state(velocity->button_dec);
 
 		if (inc_pressed) {
-			if (!velocity->inc_pressed) {
-				velocity->value += velocity->step * VELOCITY_FRACTION;
-				velocity->value = MIN(velocity->max * VELOCITY_FRACTION, velocity->value);
-				velocity->current_speed = velocity->default_speed;
-				os_schedule_task_relative(&velocity->update_task, velocity_task_cb, MS_TO_US(1000 / UPDATE_INTERVAL_MS), velocity);
+			if (!state->inc_pressed) {
+				state->value += velocity->step * VELOCITY_FRACTION;
+				state->value = MIN(velocity->max * VELOCITY_FRACTION, state->value);
+				state->current_speed = velocity->default_speed;
+				os_coro_start(&state->update_task, velocity_task_cb, state);
 			}
 		}
-		velocity->inc_pressed = inc_pressed;
+		state->inc_pressed = inc_pressed;
 
 		if (dec_pressed) {
-			if (!velocity->dec_pressed) {
-				velocity->value -= velocity->step * VELOCITY_FRACTION;
-				velocity->value = MAX(velocity->min * VELOCITY_FRACTION, velocity->value);
-				velocity->current_speed = velocity->default_speed;
-				os_schedule_task_relative(&velocity->update_task, velocity_task_cb, MS_TO_US(1000 / UPDATE_INTERVAL_MS), velocity);
+			if (!state->dec_pressed) {
+				state->value -= velocity->step * VELOCITY_FRACTION;
+				state->value = MAX(velocity->min * VELOCITY_FRACTION, state->value);
+				state->current_speed = velocity->default_speed;
+				os_coro_start(&state->update_task, velocity_task_cb, state);
 			}
 		}
-		velocity->dec_pressed = dec_pressed;
+		state->dec_pressed = dec_pressed;
 	}
 }
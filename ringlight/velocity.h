@@ -3,6 +3,13 @@
 #define VELOCITY_BRIGHTNESS 0
 #define VELOCITY_TEMPERATURE 1
 
+// Power on values
+#define VELOCITY_BRIGHTNESS_DEFAULT 500
+#define VELOCITY_TEMPERATURE_DEFAULT 500
+// Set by pressing both buttons, the brightness is dark after gamma
+#define VELOCITY_BRIGHTNESS_RESET 50
+#define VELOCITY_TEMPERATURE_RESET 500
+
 int velocity_get_value(unsigned velocity_id);
 void velocity_set_value(unsigned velocity_id, int value);
 void velocity_update(void);
@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+#
+# Static stack usage report
+#
+# Reads the call graph files (.ci) gcc emits with
+# -fcallgraph-info=su and prints the worst case stack depth of
+# every function as well as the worst case for the whole
+# firmware: main() plus the deepest interrupt handler of every
+# priority level nested on top of each other. Handlers of equal
+# priority never preempt each other.
+#
+# Priorities are taken from nvic_set_priority() calls in the
+# sources given along with the .ci files, macros are resolved
+# through #defines in any of them. Handlers without a known
+# priority are assumed to be on a level of their own.
+#
+# Indirect calls are assumed to target os task callbacks, i.e.
+# any function ending in _cb. Functions without stack information
+# (libopencm3, libgcc) are counted as zero bytes and listed.
+
+import os
+import re
+import sys
+
+# Registers stacked by Cortex-M0 hardware on exception entry
+EXCEPTION_FRAME = 32
+# Cortex-M0 only implements the top two priority bits
+PRIORITY_MASK = 0xc0
+INDIRECT_CALL = '__indirect_call'
+
+node_re = re.compile(r'node: \{ title: "([^"]+)" label: "([^"]*)"')
+edge_re = re.compile(r'edge: \{ sourcename: "([^"]+)" targetname: "([^"]+)"')
+usage_re = re.compile(r'\\n(\d+) bytes \(([^)]+)\)')
+define_re = re.compile(r'^\s*#\s*define\s+(\w+)\s+(\w+)\s*$')
+priority_re = re.compile(r'nvic_set_priority\(\s*(\w+)\s*,\s*(\w+)\s*\)')
+irq_re = re.compile(r'^NVIC_(\w+)_IRQ$')
+
+
+def short_name(title):
+    # static functions are prefixed with the full path of their source
+    return os.path.basename(title)
+
+
+def parse(paths):
+    frames = {}
+    qualifiers = {}
+    calls = {}
+
+    for path in paths:
+        with open(path) as f:
+            for line in f:
+                match = node_re.search(line)
+                if match:
+                    title, label = match.groups()
+                    title = short_name(title)
+                    usage = usage_re.search(label)
+                    if usage:
+                        frames[title] = max(frames.get(title, 0), int(usage.group(1)))
+                        qualifiers[title] = usage.group(2)
+                    calls.setdefault(title, set())
+                    continue
+                match = edge_re.search(line)
+                if match:
+                    source, target = map(short_name, match.groups())
+                    calls.setdefault(source, set()).add(target)
+
+    callbacks = {func for func in frames if func.endswith('_cb')}
+    for func, callees in calls.items():
+        if INDIRECT_CALL in callees:
+            callees.discard(INDIRECT_CALL)
+            callees |= callbacks
+
+    return frames, qualifiers, calls
+
+
+def parse_priorities(paths):
+    defines = {}
+    settings = []
+
+    for path in paths:
+        with open(path) as f:
+            for line in f:
+                match = define_re.match(line)
+                if match:
+                    defines[match.group(1)] = match.group(2)
+                settings += priority_re.findall(line)
+
+    def resolve(name):
+        seen = set()
+        while name in defines and name not in seen:
+            seen.add(name)
+            name = defines[name]
+        return name
+
+    # libopencm3 naming, NVIC_TIM1_BRK_UP_TRG_COM_IRQ is handled by tim1_brk_up_trg_com_isr
+    priorities = {}
+    for irq, priority in settings:
+        match = irq_re.match(resolve(irq))
+        try:
+            level = int(resolve(priority), 0) & PRIORITY_MASK
+        except ValueError:
+            continue
+        if match:
+            priorities[match.group(1).lower() + '_isr'] = level
+    return priorities
+
+
+def worst_case(frames, calls):
+    depth = {}
+    path = {}
+    recursive = set()
+
+    def visit(func, active):
+        if func in depth:
+            return depth[func]
+        if func in active:
+            recursive.add(func)
+            return 0
+        active.add(func)
+        best, best_callee = 0, None
+        for callee in calls.get(func, ()):
+            callee_depth = visit(callee, active)
+            if callee_depth > best:
+                best, best_callee = callee_depth, callee
+        active.discard(func)
+        depth[func] = frames.get(func, 0) + best
+        path[func] = best_callee
+        return depth[func]
+
+    for func in calls:
+        visit(func, set())
+
+    return depth, path, recursive
+
+
+def call_chain(path, func):
+    chain = []
+    while func and func not in chain:
+        chain.append(func)
+        func = path.get(func)
+    return ' > '.join(chain)
+
+
+def main():
+    if len(sys.argv) < 2:
+        print('Usage: %s <file.ci>... [<source.c|.h>...]' % sys.argv[0], file=sys.stderr)
+        sys.exit(1)
+
+    sources = [path for path in sys.argv[1:] if path.endswith(('.c', '.h'))]
+    frames, qualifiers, calls = parse(path for path in sys.argv[1:] if path not in sources)
+    priorities = parse_priorities(sources)
+    depth, path, recursive = worst_case(frames, calls)
+
+    print('%-40s %6s %6s  %s' % ('function', 'frame', 'worst', 'qualifier'))
+    for func in sorted(frames, key=lambda func: depth[func], reverse=True):
+        print('%-40s %6d %6d  %s' % (func, frames[func], depth[func], qualifiers[func]))
+
+    unknown = sorted(func for func in calls if func not in frames and func != INDIRECT_CALL)
+    if unknown:
+        print('\nNo stack information (counted as 0 bytes):')
+        for func in unknown:
+            print('  ' + func)
+
+    dynamic = sorted(func for func, qualifier in qualifiers.items() if qualifier != 'static')
+    if dynamic:
+        print('\nDynamic stack usage:')
+        for func in dynamic:
+            print('  %s (%s)' % (func, qualifiers[func]))
+
+    if recursive:
+        print('\nRecursion, depth is not bounded:')
+        for func in sorted(recursive):
+            print('  ' + func)
+
+    total = depth.get('main', 0)
+    print('\nmain: %d bytes' % total)
+    print('  ' + call_chain(path, 'main'))
+
+    levels = {}
+    for isr in sorted(func for func in frames if func.endswith('_isr')):
+        # Unknown priority, don't let it share a level with anything
+        levels.setdefault(priorities.get(isr, isr), []).append(isr)
+
+    for level, isrs in sorted(levels.items(), key=lambda item: str(item[0])):
+        if isinstance(level, int):
+            print('\nPriority 0x%02x:' % level)
+        else:
+            print('\nPriority unknown:')
+        for isr in isrs:
+            print('  %s: %d bytes' % (isr, depth[isr] + EXCEPTION_FRAME))
+            print('    ' + call_chain(path, isr))
+        total += max(depth[isr] for isr in isrs) + EXCEPTION_FRAME
+
+    print('\nWorst case, deepest interrupt of each priority level nested: %d bytes' % total)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,612 @@
+/*
+ * pwmscope - reconstruct TIM1 PWM output from a register trace and
+ * score it for flicker
+ *
+ * Usage: pwmscope [-o out.vcd] [-w window_ms] [-t tail_ms] [-p max_peak]
+ *	[-r max_ripple] trace.txt
+ *
+ * The trace is a text file, one register write per line:
+ *	<time_ns> <register> <value>
+ * Lines starting with '#' are ignored. Registers:
+ *	clk	timer input clock in Hz (default 48000000)
+ *	psc	prescaler, always takes effect on the next update event
+ *	arr	auto reload value
+ *	arpe	1 if arr is preloaded
+ *	cms	0 edge aligned, 1..3 centre aligned
+ *	ocm2	output compare mode CH2, 6 = PWM1, 7 = PWM2
+ *	ocm3	output compare mode CH3
+ *	ocpe	1 if ccr2/ccr3 are preloaded
+ *	ccr2	compare value CH2 (warm)
+ *	ccr3	compare value CH3 (cold)
+ *	cc2e	0 disables output CH2, 1 enables it (default)
+ *	cc3e	0 disables output CH3, 1 enables it (default)
+ *	cen	0 stops the counter, 1 runs it (default)
+ *	ug	update event, any value: counter to 0 counting up,
+ *		preloaded registers take effect
+ *
+ * Light output is modelled as the sum of both channels, one unit
+ * each, which is also the LED supply current. The duty of each
+ * channel, percent flicker, flicker index, the stroboscopic
+ * visibility measure (SVM, CIE TN 006:2016), peak output and RMS
+ * ripple around the mean are computed over the last window_ms of the
+ * trace. Every change of the compare values is a step, its response
+ * time is the time until the light output averaged over one PWM
+ * period is within 2% of the step of its final value.
+ *
+ * The peak output is also tracked over the whole trace for the times
+ * the channel duties add up to 1 or less, those of the active compare
+ * values. Interleaved channels never overlap then. With -p the exit
+ * status is non-zero if that peak is above max_peak, with -r if the
+ * RMS ripple is not below max_ripple.
+ */
+
+#include <complex.h>
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof(*(arr)))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define PI 3.14159265358979323846
+
+#define OCM_PWM1 6
+#define OCM_PWM2 7
+
+#define SVM_MAX_FREQ 2000.0
+#define SVM_EXPONENT 3.7
+#define STEP_SETTLE 0.02
+
+enum {
+	REG_CLK,
+	REG_PSC,
+	REG_ARR,
+	REG_ARPE,
+	REG_CMS,
+	REG_OCM2,
+	REG_OCM3,
+	REG_OCPE,
+	REG_CCR2,
+	REG_CCR3,
+	REG_CC2E,
+	REG_CC3E,
+	REG_CEN,
+	REG_UG,
+	REG_NUM
+};
+
+static const char *reg_names[REG_NUM] = {
+	"clk", "psc", "arr", "arpe", "cms", "ocm2", "ocm3", "ocpe", "ccr2", "ccr3", "cc2e", "cc3e", "cen", "ug"
+};
+
+typedef struct {
+	double time_ns;
+	int reg;
+	uint32_t value;
+} write_t;
+
+typedef struct {
+	double time_ns;
+	uint8_t warm;
+	uint8_t cold;
+} edge_t;
+
+typedef struct {
+	double time_ns;
+	double period_ns;
+} step_t;
+
+typedef struct {
+	void *data;
+	size_t len;
+	size_t size;
+	size_t elem_size;
+} vec_t;
+
+static void *vec_push(vec_t *vec) {
+	if (vec->len == vec->size) {
+		vec->size = MAX(vec->size * 2, 64);
+		vec->data = realloc(vec->data, vec->size * vec->elem_size);
+		if (!vec->data) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	return (char *)vec->data + vec->len++ * vec->elem_size;
+}
+
+static int parse_trace(const char *path, vec_t *writes) {
+	char line[256];
+	unsigned lineno = 0;
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char name[16];
+		double time_ns;
+		unsigned long value;
+		write_t *write;
+		int reg;
+
+		lineno++;
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+			continue;
+		}
+		if (sscanf(line, "%lf %15s %lu", &time_ns, name, &value) != 3) {
+			fprintf(stderr, "%s:%u: malformed line\n", path, lineno);
+			fclose(f);
+			return -1;
+		}
+		for (reg = 0; reg < REG_NUM; reg++) {
+			if (!strcmp(name, reg_names[reg])) {
+				break;
+			}
+		}
+		if (reg == REG_NUM) {
+			fprintf(stderr, "%s:%u: unknown register '%s'\n", path, lineno, name);
+			fclose(f);
+			return -1;
+		}
+		if (writes->len && time_ns < ((write_t *)writes->data)[writes->len - 1].time_ns) {
+			fprintf(stderr, "%s:%u: time goes backwards\n", path, lineno);
+			fclose(f);
+			return -1;
+		}
+
+		write = vec_push(writes);
+		write->time_ns = time_ns;
+		write->reg = reg;
+		write->value = value;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+typedef struct {
+	uint32_t active[REG_NUM];
+	uint32_t preload[REG_NUM];
+	uint32_t cnt;
+	bool down;
+} sim_timer_t;
+
+static bool reg_preloaded(const sim_timer_t *tim, int reg) {
+	switch (reg) {
+	case REG_PSC:
+		return true;
+	case REG_ARR:
+		return tim->active[REG_ARPE];
+	case REG_CCR2:
+	case REG_CCR3:
+		return tim->active[REG_OCPE];
+	default:
+		return false;
+	}
+}
+
+static void timer_write(sim_timer_t *tim, int reg, uint32_t value) {
+	tim->preload[reg] = value;
+	if (!reg_preloaded(tim, reg)) {
+		tim->active[reg] = value;
+	}
+}
+
+static void timer_update_event(sim_timer_t *tim) {
+	tim->active[REG_PSC] = tim->preload[REG_PSC];
+	tim->active[REG_ARR] = tim->preload[REG_ARR];
+	tim->active[REG_CCR2] = tim->preload[REG_CCR2];
+	tim->active[REG_CCR3] = tim->preload[REG_CCR3];
+}
+
+static void timer_generate_update(sim_timer_t *tim) {
+	tim->cnt = 0;
+	tim->down = false;
+	timer_update_event(tim);
+}
+
+/*
+ * PWM1 is active while CNT < CCR counting up and while CNT <= CCR
+ * counting down (RM0360), thus CCR / ARR of the period in centre
+ * aligned mode. PWM2 is the inverse.
+ */
+// Share of the period the channel is active at the active register values
+static double timer_duty(const sim_timer_t *tim, int ocm, int ccr, int cce) {
+	double ticks = tim->active[REG_CMS] ? tim->active[REG_ARR] : tim->active[REG_ARR] + 1;
+	double duty = MIN(tim->active[ccr], ticks) / ticks;
+
+	if (!tim->active[cce] || !ticks) {
+		return 0;
+	}
+
+	switch (tim->active[ocm]) {
+	case OCM_PWM1:
+		return duty;
+	case OCM_PWM2:
+		return 1 - duty;
+	default:
+		return 0;
+	}
+}
+
+static uint8_t timer_output(const sim_timer_t *tim, int ocm, int ccr, int cce) {
+	bool below = tim->down ? tim->cnt <= tim->active[ccr] : tim->cnt < tim->active[ccr];
+
+	if (!tim->active[cce]) {
+		return 0;
+	}
+
+	switch (tim->active[ocm]) {
+	case OCM_PWM1:
+		return below;
+	case OCM_PWM2:
+		return !below;
+	default:
+		return 0;
+	}
+}
+
+// Advance the counter by one tick, edge or centre aligned
+static void timer_tick(sim_timer_t *tim) {
+	uint32_t arr = tim->active[REG_ARR];
+
+	if (!tim->active[REG_CMS]) {
+		if (tim->cnt >= arr) {
+			tim->cnt = 0;
+			timer_update_event(tim);
+		} else {
+			tim->cnt++;
+		}
+		return;
+	}
+
+	if (tim->down) {
+		tim->cnt--;
+		if (tim->cnt == 0) {
+			tim->down = false;
+			timer_update_event(tim);
+		}
+	} else {
+		tim->cnt++;
+		if (tim->cnt >= arr) {
+			tim->down = true;
+			timer_update_event(tim);
+		}
+	}
+}
+
+static double tick_ns(const sim_timer_t *tim) {
+	return 1e9 * (tim->active[REG_PSC] + 1) / tim->active[REG_CLK];
+}
+
+/*
+ * Run the timer model over the whole trace, recording output edges,
+ * compare value steps and the nominal PWM period
+ */
+static unsigned simulate(const vec_t *writes, double end_ns, vec_t *edges, vec_t *steps) {
+	const write_t *write = writes->data;
+	const write_t *write_end = write + writes->len;
+	sim_timer_t tim = { 0 };
+	uint8_t warm = 0xff, cold = 0xff;
+	uint32_t last_ccr2 = 0, last_ccr3 = 0;
+	unsigned peak_in_duty = 0;
+	double now = 0;
+
+	tim.active[REG_CLK] = tim.preload[REG_CLK] = 48000000;
+	tim.active[REG_ARR] = tim.preload[REG_ARR] = 0xffff;
+	tim.active[REG_CC2E] = tim.preload[REG_CC2E] = 1;
+	tim.active[REG_CC3E] = tim.preload[REG_CC3E] = 1;
+	tim.active[REG_CEN] = tim.preload[REG_CEN] = 1;
+
+	while (now < end_ns) {
+		uint8_t out_warm, out_cold;
+
+		for (; write < write_end && write->time_ns <= now; write++) {
+			if (write->reg == REG_UG) {
+				timer_generate_update(&tim);
+				continue;
+			}
+			timer_write(&tim, write->reg, write->value);
+		}
+
+		if (tim.preload[REG_CCR2] != last_ccr2 || tim.preload[REG_CCR3] != last_ccr3) {
+			step_t *step = vec_push(steps);
+
+			step->time_ns = now;
+			step->period_ns = tick_ns(&tim) *
+				(tim.active[REG_CMS] ? 2 * tim.active[REG_ARR] : tim.active[REG_ARR] + 1);
+			last_ccr2 = tim.preload[REG_CCR2];
+			last_ccr3 = tim.preload[REG_CCR3];
+		}
+
+		out_warm = timer_output(&tim, REG_OCM2, REG_CCR2, REG_CC2E);
+		out_cold = timer_output(&tim, REG_OCM3, REG_CCR3, REG_CC3E);
+		if (out_warm != warm || out_cold != cold) {
+			edge_t *edge = vec_push(edges);
+
+			edge->time_ns = now;
+			edge->warm = warm = out_warm;
+			edge->cold = cold = out_cold;
+		}
+		if (out_warm + out_cold > peak_in_duty &&
+		    timer_duty(&tim, REG_OCM2, REG_CCR2, REG_CC2E) +
+		    timer_duty(&tim, REG_OCM3, REG_CCR3, REG_CC3E) <= 1 + 1e-9) {
+			peak_in_duty = out_warm + out_cold;
+		}
+
+		now += tick_ns(&tim);
+		if (tim.active[REG_CEN]) {
+			timer_tick(&tim);
+		}
+	}
+	return peak_in_duty;
+}
+
+static void write_vcd(const char *path, const vec_t *edges) {
+	const edge_t *edge = edges->data;
+	FILE *f = fopen(path, "w");
+	size_t i;
+
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+
+	fprintf(f, "$timescale 1ns $end\n");
+	fprintf(f, "$scope module tim1 $end\n");
+	fprintf(f, "$var wire 1 w warm $end\n");
+	fprintf(f, "$var wire 1 c cold $end\n");
+	fprintf(f, "$var wire 2 l light $end\n");
+	fprintf(f, "$upscope $end\n");
+	fprintf(f, "$enddefinitions $end\n");
+
+	for (i = 0; i < edges->len; i++) {
+		unsigned light = edge[i].warm + edge[i].cold;
+
+		fprintf(f, "#%.0f\n%uw\n%uc\nb%u%u l\n", edge[i].time_ns,
+			edge[i].warm, edge[i].cold, (light >> 1) & 1, light & 1);
+	}
+	fclose(f);
+}
+
+static unsigned edge_light(const edge_t *edge) {
+	return edge->warm + edge->cold;
+}
+
+// Integral of the light output from 0 to t
+static double light_integral(const vec_t *edges, const double *prefix, double t) {
+	const edge_t *edge = edges->data;
+	size_t lo = 0, hi = edges->len;
+
+	if (!edges->len || t <= edge[0].time_ns) {
+		return 0;
+	}
+	// Last edge at or before t
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+
+		if (edge[mid].time_ns <= t) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return prefix[lo] + edge_light(&edge[lo]) * (t - edge[lo].time_ns);
+}
+
+static double light_mean(const vec_t *edges, const double *prefix, double start, double end) {
+	return (light_integral(edges, prefix, end) - light_integral(edges, prefix, start)) / (end - start);
+}
+
+// Sensitivity to stroboscopic effects, CIE TN 006:2016
+static double svm_threshold(double freq) {
+	return 1 / (1 + exp(-0.00518 * (freq - 306.6))) + 20 * exp(-0.1 * freq);
+}
+
+// Returns the RMS ripple
+static double flicker_metrics(const vec_t *edges, const double *prefix, double start, double end) {
+	const edge_t *edge = edges->data;
+	double duration = end - start;
+	double mean = light_mean(edges, prefix, start, end);
+	double area_above = 0, variance = 0, svm = 0;
+	double warm_on = 0, cold_on = 0;
+	unsigned min = UINT32_MAX, max = 0;
+	unsigned harmonic;
+	size_t i;
+
+	for (i = 0; i < edges->len; i++) {
+		double seg_start = MAX(edge[i].time_ns, start);
+		double seg_end = MIN(i + 1 < edges->len ? edge[i + 1].time_ns : end, end);
+		unsigned light = edge_light(&edge[i]);
+
+		if (seg_end <= seg_start) {
+			continue;
+		}
+		min = MIN(min, light);
+		max = MAX(max, light);
+		warm_on += edge[i].warm * (seg_end - seg_start);
+		cold_on += edge[i].cold * (seg_end - seg_start);
+		variance += (light - mean) * (light - mean) * (seg_end - seg_start) / duration;
+		if (light > mean) {
+			area_above += (light - mean) * (seg_end - seg_start);
+		}
+	}
+
+	// Fourier series of the piecewise constant output over the window
+	for (harmonic = 1; harmonic * 1e9 / duration <= SVM_MAX_FREQ; harmonic++) {
+		double omega = 2 * PI * harmonic / duration;
+		double complex coeff = 0;
+		double amplitude;
+
+		for (i = 0; i < edges->len; i++) {
+			double seg_start = MAX(edge[i].time_ns, start) - start;
+			double seg_end = MIN(i + 1 < edges->len ? edge[i + 1].time_ns : end, end) - start;
+
+			if (seg_end <= seg_start) {
+				continue;
+			}
+			coeff += edge_light(&edge[i]) *
+				(cexp(-I * omega * seg_start) - cexp(-I * omega * seg_end)) / (I * omega);
+		}
+		amplitude = 2 * cabs(coeff) / duration;
+		if (mean > 0) {
+			svm += pow(amplitude / mean / svm_threshold(harmonic * 1e9 / duration), SVM_EXPONENT);
+		}
+	}
+	svm = pow(svm, 1 / SVM_EXPONENT);
+
+	printf("window:           %.3f ms\n", duration / 1e6);
+	printf("mean output:      %.4f\n", mean);
+	printf("duty warm/cold:   %.6f %.6f\n", warm_on / duration, cold_on / duration);
+	printf("percent flicker:  %.2f %%\n", max + min ? 100.0 * (max - min) / (max + min) : 0);
+	printf("flicker index:    %.4f\n", mean > 0 ? area_above / (mean * duration) : 0);
+	printf("SVM:              %.3f\n", svm);
+	printf("peak output:      %u\n", max);
+	printf("RMS ripple:       %.4f\n", sqrt(variance));
+	return sqrt(variance);
+}
+
+static void step_responses(const vec_t *edges, const double *prefix, const vec_t *steps, double end) {
+	const step_t *step = steps->data;
+	double worst = 0, total = 0;
+	unsigned settled = 0;
+	size_t i;
+
+	for (i = 0; i < steps->len; i++) {
+		double period = step[i].period_ns;
+		double next = i + 1 < steps->len ? step[i + 1].time_ns : end;
+		double before, after, t;
+
+		if (step[i].time_ns - period < 0 || next - period < step[i].time_ns) {
+			continue;
+		}
+		before = light_mean(edges, prefix, step[i].time_ns - period, step[i].time_ns);
+		after = light_mean(edges, prefix, next - period, next);
+		if (fabs(after - before) < 1e-9) {
+			continue;
+		}
+
+		for (t = step[i].time_ns; t + period <= next; t += period / 16) {
+			double mean = light_mean(edges, prefix, t, t + period);
+
+			if (fabs(mean - after) <= STEP_SETTLE * fabs(after - before)) {
+				break;
+			}
+		}
+		if (t + period > next) {
+			continue;
+		}
+		// Response complete once the averaging period ends
+		t = t + period - step[i].time_ns;
+		worst = MAX(worst, t);
+		total += t;
+		settled++;
+	}
+
+	printf("steps:            %u\n", settled);
+	if (settled) {
+		printf("step response:    %.3f ms mean, %.3f ms worst\n", total / settled / 1e6, worst / 1e6);
+	}
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [-o out.vcd] [-w window_ms] [-t tail_ms] [-p max_peak] [-r max_ripple] trace.txt\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	vec_t writes = { .elem_size = sizeof(write_t) };
+	vec_t edges = { .elem_size = sizeof(edge_t) };
+	vec_t steps = { .elem_size = sizeof(step_t) };
+	const char *vcd_path = NULL;
+	double window_ms = 100, tail_ms = 100;
+	double max_peak = -1, max_ripple = -1;
+	double end_ns, start_ns, ripple;
+	unsigned peak_in_duty;
+	int ret = 0;
+	double *prefix;
+	edge_t *edge;
+	size_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:w:t:p:r:")) != -1) {
+		switch (opt) {
+		case 'o':
+			vcd_path = optarg;
+			break;
+		case 'w':
+			window_ms = atof(optarg);
+			break;
+		case 't':
+			tail_ms = atof(optarg);
+			break;
+		case 'p':
+			max_peak = atof(optarg);
+			break;
+		case 'r':
+			max_ripple = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind + 1 != argc || window_ms <= 0 || tail_ms < 0) {
+		usage(argv[0]);
+	}
+
+	if (parse_trace(argv[optind], &writes)) {
+		return 1;
+	}
+	if (!writes.len) {
+		fprintf(stderr, "Empty trace\n");
+		return 1;
+	}
+
+	end_ns = ((write_t *)writes.data)[writes.len - 1].time_ns + tail_ms * 1e6;
+	peak_in_duty = simulate(&writes, end_ns, &edges, &steps);
+
+	if (vcd_path) {
+		write_vcd(vcd_path, &edges);
+	}
+
+	// prefix[i] is the integral of the light output up to edge i
+	edge = edges.data;
+	prefix = calloc(MAX(edges.len, 1), sizeof(*prefix));
+	if (!prefix) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 1; i < edges.len; i++) {
+		prefix[i] = prefix[i - 1] + edge_light(&edge[i - 1]) * (edge[i].time_ns - edge[i - 1].time_ns);
+	}
+
+	start_ns = MAX(end_ns - window_ms * 1e6, 0);
+	ripple = flicker_metrics(&edges, prefix, start_ns, end_ns);
+	printf("peak, duty <= 1:  %u\n", peak_in_duty);
+	step_responses(&edges, prefix, &steps, end_ns);
+
+	if (max_peak >= 0 && peak_in_duty > max_peak) {
+		fprintf(stderr, "%s: peak output %u above %g with duties adding up to 1 or less\n",
+			argv[optind], peak_in_duty, max_peak);
+		ret = 1;
+	}
+	if (max_ripple >= 0 && ripple >= max_ripple) {
+		fprintf(stderr, "%s: RMS ripple %.4f not below %g\n", argv[optind], ripple, max_ripple);
+		ret = 1;
+	}
+
+	free(prefix);
+	free(writes.data);
+	free(edges.data);
+	free(steps.data);
+	return ret;
+}
@@ -0,0 +1,90 @@
+/*
+ * coro_bench - dispatch cost of callback tasks vs coroutines
+ *
+ * Usage: coro_bench [dispatches]
+ *
+ * Runs the real os.c on the simulated OS timer. Each variant
+ * reschedules itself as soon as possible, once as a plain callback
+ * that re-arms its own task and once as a coroutine looping over
+ * OS_CORO_YIELD(). Host time is only a proxy for the Cortex-M0,
+ * what matters is the difference between the two.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <libopencm3/stm32/rcc.h>
+
+#include "os.h"
+#include "os_coro.h"
+
+#define BENCH_ROUNDS 5
+
+static os_task_t bench_task = OS_TASK_INITIALIZER;
+static unsigned long dispatches;
+
+static void callback_cb(void *ctx) {
+	dispatches++;
+	os_schedule_task_relative(&bench_task, callback_cb, 1, ctx);
+}
+
+static void coro_cb(void *ctx) {
+	(void)ctx;
+
+	OS_CORO_BEGIN(&bench_task);
+	for (;;) {
+		dispatches++;
+		OS_CORO_YIELD(&bench_task);
+	}
+	OS_CORO_END(&bench_task);
+}
+
+static double now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Best of BENCH_ROUNDS, host ns per dispatch including os_run()
+static double bench(os_task_f cb, unsigned long count) {
+	double best = 0;
+	unsigned round;
+
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		double start, ns;
+
+		bench_task.coro_line = 0;
+		os_schedule_task_relative(&bench_task, cb, 0, NULL);
+		dispatches = 0;
+		start = now_ns();
+		while (dispatches < count) {
+			os_run();
+		}
+		ns = (now_ns() - start) / count;
+		os_cancel_task(&bench_task);
+		if (!round || ns < best) {
+			best = ns;
+		}
+	}
+	return best;
+}
+
+int main(int argc, char **argv) {
+	unsigned long count = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	double callback_ns, coro_ns;
+
+	rcc_clock_setup_in_hsi_out_48mhz();
+	os_init();
+
+	callback_ns = bench(callback_cb, count);
+	coro_ns = bench(coro_cb, count);
+
+	printf("dispatches:  %lu x %u rounds\n", count, BENCH_ROUNDS);
+	printf("callback:    %.1f ns\n", callback_ns);
+	printf("coroutine:   %.1f ns\n", coro_ns);
+	printf("overhead:    %+.1f ns (%+.1f %%)\n", coro_ns - callback_ns,
+	       100 * (coro_ns - callback_ns) / callback_ns);
+	return 0;
+}
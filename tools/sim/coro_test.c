@@ -0,0 +1,255 @@
+/*
+ * coro_test - coroutine await primitives
+ *
+ * Runs coroutines on the real os.c and button.c with the simulated
+ * OS timer and GPIOs, the main loop calls os_run() and button_update()
+ * like main.c. Every resume is logged with its time since the start
+ * of the scenario and checked against the expected order and a time
+ * window:
+ *  - BUTTON_CORO_AWAIT() on a press and a release, both with contact
+ *    bounce, within BUTTON_AWAIT_POLL_MS of the debounced change
+ *  - OS_CORO_AWAIT_TASK() joining a coroutine and a plain callback
+ *    task, within JOIN_POLL_US of it finishing
+ *  - os_coro_stop() in the middle of a delay and a button await,
+ *    neither may resume, a joiner must and a restart begins at the top
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/stm32/rcc.h>
+
+#include "button.h"
+#include "gpiod.h"
+#include "os.h"
+#include "os_coro.h"
+#include "sim.h"
+#include "util.h"
+
+#define LOG_MAX 16
+#define NS_PER_US 1000ULL
+#define JOIN_POLL_US 1000
+// One pass of the main loop and the os_run() slow path
+#define SLACK_US 50
+// Longer than BUTTON_AWAIT_POLL_MS, shorter than DEBOUNCE_MS of button.c
+#define BOUNCE_MS 7
+
+typedef struct {
+	const char *what;
+	uint64_t us;
+} resume_t;
+
+typedef struct {
+	const char *what;
+	uint32_t min_us;
+	uint32_t max_us;
+} expect_t;
+
+static resume_t log_g[LOG_MAX];
+static unsigned logged_g;
+static uint64_t start_ns;
+static unsigned failures;
+
+static os_task_t button_task = OS_TASK_INITIALIZER;
+static os_task_t worker_task = OS_TASK_INITIALIZER;
+static os_task_t callback_task = OS_TASK_INITIALIZER;
+static os_task_t joiner_task = OS_TASK_INITIALIZER;
+static os_task_t stopper_task = OS_TASK_INITIALIZER;
+
+static void mark(const char *what) {
+	if (logged_g == LOG_MAX) {
+		fprintf(stderr, "resume log full\n");
+		exit(1);
+	}
+	log_g[logged_g].what = what;
+	log_g[logged_g].us = (sim_now_ns - start_ns) / NS_PER_US;
+	logged_g++;
+}
+
+static void press_cb(void *ctx) {
+	(void)ctx;
+	// Buttons pull to ground
+	sim_gpio_input(gpiod_get_port(GPIO_BRIGHTER), gpiod_get_gpio(GPIO_BRIGHTER), false);
+}
+
+static void release_cb(void *ctx) {
+	(void)ctx;
+	sim_gpio_input(gpiod_get_port(GPIO_BRIGHTER), gpiod_get_gpio(GPIO_BRIGHTER), true);
+}
+
+// Edge at ms, bouncing back 1ms later for BOUNCE_MS
+static void bounce_at(uint32_t ms, sim_event_f edge, sim_event_f bounce) {
+	sim_at(start_ns + MS_TO_US(ms) * NS_PER_US, edge, NULL);
+	sim_at(start_ns + MS_TO_US(ms + 1) * NS_PER_US, bounce, NULL);
+	sim_at(start_ns + MS_TO_US(ms + 1 + BOUNCE_MS) * NS_PER_US, edge, NULL);
+}
+
+static void button_coro_cb(void *ctx) {
+	(void)ctx;
+
+	OS_CORO_BEGIN(&button_task);
+	mark("await press");
+	BUTTON_CORO_AWAIT(&button_task, BUTTON_BRIGHTER, true);
+	mark("pressed");
+	BUTTON_CORO_AWAIT(&button_task, BUTTON_BRIGHTER, false);
+	mark("released");
+	OS_CORO_END(&button_task);
+}
+
+static void worker_coro_cb(void *ctx) {
+	(void)ctx;
+
+	OS_CORO_BEGIN(&worker_task);
+	mark("worker start");
+	OS_CORO_AWAIT_DELAY(&worker_task, MS_TO_US(30));
+	mark("worker done");
+	OS_CORO_END(&worker_task);
+}
+
+static void callback_cb(void *ctx) {
+	(void)ctx;
+
+	mark("callback");
+}
+
+static void joiner_coro_cb(void *ctx) {
+	(void)ctx;
+
+	OS_CORO_BEGIN(&joiner_task);
+	mark("join worker");
+	OS_CORO_AWAIT_TASK(&joiner_task, &worker_task, JOIN_POLL_US);
+	mark("worker joined");
+	OS_CORO_AWAIT_TASK(&joiner_task, &callback_task, JOIN_POLL_US);
+	mark("callback joined");
+	OS_CORO_END(&joiner_task);
+}
+
+static void stopper_cb(void *ctx) {
+	(void)ctx;
+
+	mark("stop");
+	os_coro_stop(&worker_task);
+	os_coro_stop(&button_task);
+	if (os_coro_running(&worker_task) || os_coro_running(&button_task)) {
+		mark("still running");
+	}
+}
+
+static void run_ms(uint32_t ms) {
+	while (sim_now_ns - start_ns < MS_TO_US(ms) * NS_PER_US) {
+		os_run();
+		button_update();
+	}
+}
+
+static void begin(void) {
+	start_ns = sim_now_ns;
+	logged_g = 0;
+}
+
+static void check(const char *scenario, const expect_t *expect, unsigned count) {
+	unsigned i;
+
+	for (i = 0; i < MAX(count, logged_g); i++) {
+		if (i >= logged_g) {
+			printf("FAIL %s: no %s\n", scenario, expect[i].what);
+		} else if (i >= count) {
+			printf("FAIL %s: unexpected %s at %" PRIu64 " us\n", scenario, log_g[i].what, log_g[i].us);
+		} else if (strcmp(log_g[i].what, expect[i].what)) {
+			printf("FAIL %s: %s at %" PRIu64 " us, expected %s\n", scenario,
+			       log_g[i].what, log_g[i].us, expect[i].what);
+		} else if (log_g[i].us < expect[i].min_us || log_g[i].us > expect[i].max_us) {
+			printf("FAIL %s: %s at %" PRIu64 " us, expected %" PRIu32 " to %" PRIu32 " us\n", scenario,
+			       log_g[i].what, log_g[i].us, expect[i].min_us, expect[i].max_us);
+		} else {
+			continue;
+		}
+		failures++;
+	}
+	printf("%s: %u resumes\n", scenario, logged_g);
+}
+
+/*
+ * The press goes through at once and holds the state for DEBOUNCE_MS,
+ * the bounce must not look like a release
+ */
+static void test_button(void) {
+	static const expect_t expect[] = {
+		{ "await press", 0, SLACK_US },
+		{ "pressed", MS_TO_US(20), MS_TO_US(20 + BUTTON_AWAIT_POLL_MS) + SLACK_US },
+		{ "released", MS_TO_US(50), MS_TO_US(50 + BUTTON_AWAIT_POLL_MS) + SLACK_US },
+	};
+
+	begin();
+	bounce_at(20, press_cb, release_cb);
+	bounce_at(50, release_cb, press_cb);
+	os_coro_start(&button_task, button_coro_cb, NULL);
+	run_ms(100);
+	check("button", expect, ARRAY_SIZE(expect));
+}
+
+static void test_join(void) {
+	static const expect_t expect[] = {
+		{ "worker start", 0, SLACK_US },
+		{ "join worker", 0, SLACK_US },
+		{ "worker done", MS_TO_US(30), MS_TO_US(30) + SLACK_US },
+		{ "worker joined", MS_TO_US(30), MS_TO_US(30) + JOIN_POLL_US + SLACK_US },
+		{ "callback", MS_TO_US(45), MS_TO_US(45) + SLACK_US },
+		{ "callback joined", MS_TO_US(45), MS_TO_US(45) + JOIN_POLL_US + SLACK_US },
+	};
+
+	begin();
+	os_coro_start(&worker_task, worker_coro_cb, NULL);
+	os_coro_start(&joiner_task, joiner_coro_cb, NULL);
+	os_schedule_task_relative(&callback_task, callback_cb, MS_TO_US(45), NULL);
+	run_ms(100);
+	check("join", expect, ARRAY_SIZE(expect));
+}
+
+/*
+ * Stopped mid delay and mid button await, the press comes after the
+ * stop. Nothing may resume until the worker is started again.
+ */
+static void test_stop(void) {
+	static const expect_t expect[] = {
+		{ "worker start", 0, SLACK_US },
+		{ "join worker", 0, SLACK_US },
+		{ "await press", 0, SLACK_US },
+		{ "stop", MS_TO_US(20), MS_TO_US(20) + SLACK_US },
+		{ "worker joined", MS_TO_US(20), MS_TO_US(20) + JOIN_POLL_US + SLACK_US },
+		{ "callback joined", MS_TO_US(20), MS_TO_US(20) + JOIN_POLL_US + SLACK_US },
+		{ "worker start", MS_TO_US(100), MS_TO_US(100) + SLACK_US },
+		{ "worker done", MS_TO_US(130), MS_TO_US(130) + SLACK_US },
+	};
+
+	begin();
+	os_coro_start(&worker_task, worker_coro_cb, NULL);
+	os_coro_start(&joiner_task, joiner_coro_cb, NULL);
+	os_coro_start(&button_task, button_coro_cb, NULL);
+	os_schedule_task_relative(&stopper_task, stopper_cb, MS_TO_US(20), NULL);
+	bounce_at(40, press_cb, release_cb);
+	bounce_at(60, release_cb, press_cb);
+	run_ms(100);
+	os_coro_start(&worker_task, worker_coro_cb, NULL);
+	run_ms(200);
+	check("stop", expect, ARRAY_SIZE(expect));
+}
+
+int main(void) {
+	rcc_clock_setup_in_hsi_out_48mhz();
+	os_init();
+	gpiod_init();
+
+	test_button();
+	test_join();
+	test_stop();
+
+	if (failures) {
+		printf("%u failures\n", failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
@@ -0,0 +1,272 @@
+/*
+ * encoder_test - encoder delta and acceleration math
+ *
+ * Runs the encoder.c poll task on the scheduler like the firmware and
+ * feeds it quadrature edges at their times on the simulated TIM3
+ * encoder interface, input filter included. Every poll is checked
+ * against a 64-bit reference count: no counts may be lost or gained
+ * across 16-bit counter wraps, partial detents must carry over and
+ * each poll must apply detents * encoder_accel[speed]. The edges of a
+ * poll interval are spread evenly across it, clear of the polls.
+ * Brightness is captured unclamped by stand-ins for velocity.c.
+ *
+ * Last, the rotation speed is swept up to and past what the input
+ * filter passes. Below that nothing may be lost, where losses start
+ * is reported.
+ */
+
+#include "../../ringlight/encoder.c"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define NS_PER_US 1000ULL
+#define POLL_NS (MS_TO_US(ENCODER_POLL_MS) * NS_PER_US)
+// Edges end this long before a poll, longer than the filter delay
+#define EDGE_MARGIN_NS 20000ULL
+#define BOUNCE_NS 500
+/*
+ * TIM_IC_DTF_DIV_32_N_8 at 48MHz passes a level after 8 samples of
+ * 32 clocks. Each input changes on every second count, so a count
+ * may take 4 samples, 18750 counts per poll interval. Far below the
+ * 32767 counts the int16_t delta of encoder.c can take.
+ */
+#define FILTER_SAMPLE_NS (32 * 1e9 / 48e6)
+#define FILTER_LIMIT ((int)(2 * (POLL_NS - 2 * EDGE_MARGIN_NS) / (8 * FILTER_SAMPLE_NS)))
+#define SWEEP_STEP 1000
+#define SWEEP_MAX 24000
+#define SWEEP_POLLS 4
+
+// Forward quadrature sequence of (TI1, TI2)
+static const uint8_t quadrature[] = { 0x0, 0x2, 0x3, 0x1 };
+static const int forward = 1;
+static const int back = -1;
+
+static struct {
+	uint64_t start_ns;
+	uint64_t span_ns;
+	unsigned edges;
+	unsigned next;
+	const int *dir;
+	const int *undo;
+	unsigned bounces;
+} train;
+
+static int brightness;
+static unsigned phase;
+static int64_t position;
+static int64_t credited;
+static unsigned wraps;
+static unsigned polls;
+static unsigned failures;
+
+int velocity_get_value(unsigned velocity_id) {
+	return velocity_id == VELOCITY_BRIGHTNESS ? brightness : 0;
+}
+
+void velocity_set_value(unsigned velocity_id, int value) {
+	if (velocity_id != VELOCITY_BRIGHTNESS) {
+		fprintf(stderr, "encoder changed velocity %u\n", velocity_id);
+		exit(1);
+	}
+	brightness = value;
+}
+
+static void edge_cb(void *ctx) {
+	int dir = *(const int *)ctx;
+
+	phase = (phase + (dir > 0 ? 1 : 3)) % ARRAY_SIZE(quadrature);
+	sim_timer_encoder(ENCODER_TIMER, quadrature[phase] & 2, quadrature[phase] & 1);
+	position += dir;
+	// Counter started at 0, going past 0xffff or below 0
+	if ((dir > 0 && !(position & 0xffff)) || (dir < 0 && (position & 0xffff) == 0xffff)) {
+		wraps++;
+	}
+}
+
+// Each edge schedules the next, keeps the event queue short
+static void train_cb(void *ctx) {
+	unsigned i;
+
+	(void)ctx;
+
+	edge_cb((void *)train.dir);
+	for (i = 0; i < train.bounces; i++) {
+		sim_at(sim_now_ns + (2 * i + 1) * BOUNCE_NS, edge_cb, (void *)train.undo);
+		sim_at(sim_now_ns + (2 * i + 2) * BOUNCE_NS, edge_cb, (void *)train.dir);
+	}
+	if (++train.next < train.edges) {
+		sim_at(train.start_ns + train.span_ns * train.next / train.edges, train_cb, NULL);
+	}
+}
+
+// Spreads counts edges evenly across the next poll interval, with bounce each
+static void turn_bouncing(int counts, unsigned bounces) {
+	train.start_ns = sim_now_ns + EDGE_MARGIN_NS;
+	train.span_ns = POLL_NS - 2 * EDGE_MARGIN_NS;
+	train.edges = ABS(counts);
+	train.next = 0;
+	train.dir = counts > 0 ? &forward : &back;
+	train.undo = counts > 0 ? &back : &forward;
+	train.bounces = bounces;
+	if (counts) {
+		sim_at(train.start_ns, train_cb, NULL);
+	}
+}
+
+static void turn(int counts) {
+	turn_bouncing(counts, 0);
+}
+
+// Runs the main loop until the encoder task has polled once more
+static void run_poll(void) {
+	os_time_t deadline = encoder_task.deadline;
+
+	while (!memcmp(&deadline, &encoder_task.deadline, sizeof(deadline))) {
+		os_run();
+	}
+	polls++;
+}
+
+static void poll(const char *scenario) {
+	int before = brightness;
+	int64_t pending;
+	int64_t detents;
+	int64_t speed;
+	int expected;
+
+	// All edges of the interval are through the filter by the poll
+	run_poll();
+	pending = position - credited;
+	detents = pending / ENCODER_COUNTS_PER_DETENT;
+	speed = MIN(ABS(detents), (int64_t)ARRAY_SIZE(encoder_accel) - 1);
+	expected = detents * encoder_accel[speed];
+	credited += detents * ENCODER_COUNTS_PER_DETENT;
+
+	if (brightness - before != expected) {
+		printf("FAIL %s poll %u: %+d steps, expected %+d (%+" PRId64 " counts pending)\n",
+		       scenario, polls, brightness - before, expected, pending);
+		failures++;
+	}
+	if ((uint16_t)(timer_get_counter(ENCODER_TIMER) - last_count) != (uint16_t)(position - credited)) {
+		printf("FAIL %s poll %u: %d counts carried over, expected %" PRId64 "\n",
+		       scenario, polls, (int16_t)(timer_get_counter(ENCODER_TIMER) - last_count),
+		       position - credited);
+		failures++;
+	}
+}
+
+// Constant speed, counts per poll interval
+static void spin(const char *scenario, int counts, unsigned count_polls) {
+	unsigned i;
+
+	for (i = 0; i < count_polls; i++) {
+		turn(counts);
+		poll(scenario);
+	}
+}
+
+// Counts missing on the counter after count_polls at counts per poll interval
+static int64_t spin_lost(int counts, unsigned count_polls) {
+	int64_t counted = 0;
+	uint16_t prev = timer_get_counter(ENCODER_TIMER);
+	unsigned i;
+
+	for (i = 0; i < count_polls; i++) {
+		turn(counts);
+		run_poll();
+		counted += (int16_t)(timer_get_counter(ENCODER_TIMER) - prev);
+		prev = timer_get_counter(ENCODER_TIMER);
+	}
+	return (int64_t)counts * count_polls - counted;
+}
+
+static void sweep(void) {
+	int first_lost = 0;
+	int counts;
+
+	for (counts = SWEEP_STEP; counts <= SWEEP_MAX; counts += SWEEP_STEP) {
+		int64_t lost = spin_lost(counts, SWEEP_POLLS);
+
+		if (lost && counts <= FILTER_LIMIT) {
+			printf("FAIL sweep: %" PRId64 " of %d counts lost at %d counts per poll\n",
+			       lost, counts * SWEEP_POLLS, counts);
+			failures++;
+		}
+		if (lost && !first_lost) {
+			first_lost = counts;
+		}
+	}
+	if (!first_lost) {
+		printf("sweep: no losses up to %d counts per poll, filter limit %d\n", SWEEP_MAX, FILTER_LIMIT);
+	} else {
+		printf("sweep: losses start at %d counts per poll, filter limit %d\n", first_lost, FILTER_LIMIT);
+	}
+	// Otherwise the filter is weaker than the firmware asks for
+	if (!first_lost || first_lost > FILTER_LIMIT + SWEEP_STEP) {
+		printf("FAIL sweep: no losses past the filter limit\n");
+		failures++;
+	}
+}
+
+int main(void) {
+	unsigned i;
+
+	rcc_clock_setup_in_hsi_out_48mhz();
+	os_init();
+	encoder_init();
+
+	spin("single detents", 4, 10);
+	spin("single detents back", -4, 10);
+
+	// 1.5 detents per poll, the half carries over
+	spin("partial detents", 6, 8);
+	spin("partial detents back", -6, 8);
+
+	// Stop mid detent, then wiggle around it without completing one
+	turn(2);
+	poll("mid detent");
+	for (i = 0; i < 20; i++) {
+		turn(i & 1 ? 3 : -3);
+		poll("wiggle");
+	}
+	turn(-1);
+	poll("wiggle");
+
+	// Contact bounce shorter than the filter on every edge, even at speed
+	for (i = 0; i < 10; i++) {
+		turn_bouncing(i & 1 ? -40 : 50, 2);
+		poll("bounce");
+	}
+	turn_bouncing(2000, 1);
+	poll("bounce");
+
+	// ~10000 detents per second, wraps below zero within the first poll
+	spin("fast back", -2000, 40);
+	spin("fast", 2000, 80);
+
+	// Just below the filter limit
+	spin("fastest", FILTER_LIMIT - 100, 10);
+	spin("fastest back", -(FILTER_LIMIT - 100), 10);
+
+	// Every acceleration step, including partial detents on top
+	for (i = 0; i < 4 * ARRAY_SIZE(encoder_accel) + 4; i++) {
+		spin("accel", i, 1);
+		spin("accel back", -(int)i, 1);
+	}
+
+	printf("%u polls, %" PRId64 " counts net, %u counter wraps\n", polls, position, wraps);
+
+	sweep();
+
+	if (failures) {
+		printf("%u failures\n", failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
@@ -0,0 +1,3 @@
+// ringlight main.c with main() renamed, the host main() is in lamp.c
+#define main firmware_main
+#include "main.c"
@@ -0,0 +1,4 @@
+#pragma once
+
+void cm_enable_interrupts(void);
+void cm_disable_interrupts(void);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+#define NVIC_EXTI0_1_IRQ 5
+#define NVIC_EXTI2_3_IRQ 6
+#define NVIC_EXTI4_15_IRQ 7
+#define NVIC_TIM1_BRK_UP_TRG_COM_IRQ 13
+#define NVIC_TIM3_IRQ 16
+#define NVIC_TIM14_IRQ 19
+#define NVIC_USART1_IRQ 27
+#define NVIC_IRQ_COUNT 32
+
+void nvic_set_priority(uint8_t irqn, uint8_t priority);
+void nvic_enable_irq(uint8_t irqn);
+void nvic_disable_irq(uint8_t irqn);
+
+void exti0_1_isr(void);
+void exti2_3_isr(void);
+void exti4_15_isr(void);
+void tim1_brk_up_trg_com_isr(void);
+void tim3_isr(void);
+void tim14_isr(void);
+void usart1_isr(void);
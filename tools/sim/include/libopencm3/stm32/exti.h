@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+extern volatile uint32_t sim_exti_pr;
+
+#define EXTI_PR sim_exti_pr
+
+#define EXTI0 (1 << 0)
+#define EXTI1 (1 << 1)
+#define EXTI2 (1 << 2)
+#define EXTI3 (1 << 3)
+#define EXTI4 (1 << 4)
+#define EXTI5 (1 << 5)
+#define EXTI6 (1 << 6)
+#define EXTI7 (1 << 7)
+
+enum exti_trigger_type {
+	EXTI_TRIGGER_RISING,
+	EXTI_TRIGGER_FALLING,
+	EXTI_TRIGGER_BOTH,
+};
+
+void exti_set_trigger(uint32_t extis, enum exti_trigger_type trig);
+void exti_enable_request(uint32_t extis);
+void exti_select_source(uint32_t exti, uint32_t gpioport);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+#define GPIOA 0x48000000U
+#define GPIOF 0x48001400U
+
+#define GPIO0 (1 << 0)
+#define GPIO1 (1 << 1)
+#define GPIO2 (1 << 2)
+#define GPIO3 (1 << 3)
+#define GPIO4 (1 << 4)
+#define GPIO5 (1 << 5)
+#define GPIO6 (1 << 6)
+#define GPIO7 (1 << 7)
+#define GPIO8 (1 << 8)
+#define GPIO9 (1 << 9)
+#define GPIO10 (1 << 10)
+
+#define GPIO_MODE_INPUT 0x00
+#define GPIO_MODE_OUTPUT 0x01
+#define GPIO_MODE_AF 0x02
+#define GPIO_MODE_ANALOG 0x03
+
+#define GPIO_PUPD_NONE 0x00
+#define GPIO_PUPD_PULLUP 0x01
+#define GPIO_PUPD_PULLDOWN 0x02
+
+#define GPIO_OTYPE_PP 0x00
+#define GPIO_OTYPE_OD 0x01
+
+#define GPIO_OSPEED_2MHZ 0x00
+#define GPIO_OSPEED_25MHZ 0x01
+#define GPIO_OSPEED_50MHZ 0x03
+
+#define GPIO_AF0 0x00
+#define GPIO_AF1 0x01
+#define GPIO_AF2 0x02
+
+void gpio_mode_setup(uint32_t gpioport, uint8_t mode, uint8_t pull_up_down, uint16_t gpios);
+void gpio_set_output_options(uint32_t gpioport, uint8_t otype, uint8_t speed, uint16_t gpios);
+void gpio_set_af(uint32_t gpioport, uint8_t alt_func_num, uint16_t gpios);
+void gpio_set(uint32_t gpioport, uint16_t gpios);
+void gpio_clear(uint32_t gpioport, uint16_t gpios);
+uint16_t gpio_get(uint32_t gpioport, uint16_t gpios);
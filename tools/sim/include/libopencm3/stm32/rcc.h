@@ -0,0 +1,32 @@
+#pragma once
+
+/*
+ * Host stand-in for libopencm3, only what ringlight uses.
+ * Implemented by the peripheral models in tools/sim/opencm3.c.
+ */
+
+#include <stdint.h>
+
+enum rcc_periph_clken {
+	RCC_GPIOA,
+	RCC_GPIOF,
+	RCC_TIM1,
+	RCC_TIM3,
+	RCC_TIM14,
+	RCC_SYSCFG_COMP,
+	RCC_USART1,
+};
+
+enum rcc_periph_rst {
+	RST_TIM1,
+	RST_TIM3,
+	RST_TIM14,
+	RST_USART1,
+};
+
+extern uint32_t rcc_ahb_frequency;
+extern uint32_t rcc_apb1_frequency;
+
+void rcc_periph_clock_enable(enum rcc_periph_clken clken);
+void rcc_periph_reset_pulse(enum rcc_periph_rst rst);
+void rcc_clock_setup_in_hsi_out_48mhz(void);
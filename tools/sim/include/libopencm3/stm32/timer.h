@@ -0,0 +1,141 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIM1 0x40012C00U
+#define TIM3 0x40000400U
+#define TIM14 0x40002000U
+
+volatile uint32_t *sim_timer_reg(uint32_t timer, uint32_t offset);
+
+#define TIM_CR1(tim) (*sim_timer_reg((tim), 0x00))
+#define TIM_CCR2(tim) (*sim_timer_reg((tim), 0x38))
+
+#define TIM_CR1_CKD_CK_INT (0 << 8)
+#define TIM_CR1_ARPE (1 << 7)
+#define TIM_CR1_CMS_EDGE (0 << 5)
+#define TIM_CR1_CMS_CENTER_1 (1 << 5)
+#define TIM_CR1_CMS_CENTER_2 (2 << 5)
+#define TIM_CR1_CMS_CENTER_3 (3 << 5)
+#define TIM_CR1_CMS_MASK (3 << 5)
+#define TIM_CR1_DIR_UP (0 << 4)
+#define TIM_CR1_DIR_DOWN (1 << 4)
+#define TIM_CR1_URS (1 << 2)
+#define TIM_CR1_CEN (1 << 0)
+
+#define TIM_CR2_MMS_RESET (0 << 4)
+#define TIM_CR2_MMS_UPDATE (2 << 4)
+
+#define TIM_SMCR_SMS_OFF 0
+#define TIM_SMCR_SMS_EM1 1
+#define TIM_SMCR_SMS_EM2 2
+#define TIM_SMCR_SMS_EM3 3
+#define TIM_SMCR_SMS_RM 4
+#define TIM_SMCR_SMS_GM 5
+#define TIM_SMCR_SMS_TM 6
+#define TIM_SMCR_TS_ITR0 (0 << 4)
+#define TIM_SMCR_TS_ITR1 (1 << 4)
+#define TIM_SMCR_TS_ITR2 (2 << 4)
+#define TIM_SMCR_TS_ITR3 (3 << 4)
+#define TIM_SMCR_TS_TI1FP1 (5 << 4)
+#define TIM_SMCR_TS_TI2FP2 (6 << 4)
+
+#define TIM_DIER_UIE (1 << 0)
+#define TIM_DIER_CC2IE (1 << 2)
+
+#define TIM_SR_UIF (1 << 0)
+#define TIM_SR_CC2IF (1 << 2)
+#define TIM_SR_CC2OF (1 << 10)
+
+#define TIM_EGR_UG (1 << 0)
+
+enum tim_oc_id {
+	TIM_OC1,
+	TIM_OC1N,
+	TIM_OC2,
+	TIM_OC2N,
+	TIM_OC3,
+	TIM_OC3N,
+	TIM_OC4,
+};
+
+enum tim_oc_mode {
+	TIM_OCM_FROZEN,
+	TIM_OCM_ACTIVE,
+	TIM_OCM_INACTIVE,
+	TIM_OCM_TOGGLE,
+	TIM_OCM_FORCE_LOW,
+	TIM_OCM_FORCE_HIGH,
+	TIM_OCM_PWM1,
+	TIM_OCM_PWM2,
+};
+
+enum tim_ic_id {
+	TIM_IC1,
+	TIM_IC2,
+	TIM_IC3,
+	TIM_IC4,
+};
+
+enum tim_ic_input {
+	TIM_IC_OUT,
+	TIM_IC_IN_TI1,
+	TIM_IC_IN_TI2,
+	TIM_IC_IN_TRC,
+	TIM_IC_IN_TI3,
+	TIM_IC_IN_TI4,
+};
+
+enum tim_ic_filter {
+	TIM_IC_OFF,
+	TIM_IC_CK_INT_N_2,
+	TIM_IC_CK_INT_N_4,
+	TIM_IC_CK_INT_N_8,
+	TIM_IC_DTF_DIV_2_N_6,
+	TIM_IC_DTF_DIV_2_N_8,
+	TIM_IC_DTF_DIV_4_N_6,
+	TIM_IC_DTF_DIV_4_N_8,
+	TIM_IC_DTF_DIV_8_N_6,
+	TIM_IC_DTF_DIV_8_N_8,
+	TIM_IC_DTF_DIV_16_N_5,
+	TIM_IC_DTF_DIV_16_N_6,
+	TIM_IC_DTF_DIV_16_N_8,
+	TIM_IC_DTF_DIV_32_N_5,
+	TIM_IC_DTF_DIV_32_N_6,
+	TIM_IC_DTF_DIV_32_N_8,
+};
+
+enum tim_ic_pol {
+	TIM_IC_RISING,
+	TIM_IC_FALLING,
+};
+
+void timer_set_mode(uint32_t timer_peripheral, uint32_t clock_div, uint32_t alignment, uint32_t direction);
+void timer_set_prescaler(uint32_t timer_peripheral, uint32_t value);
+void timer_set_period(uint32_t timer_peripheral, uint32_t period);
+void timer_set_counter(uint32_t timer_peripheral, uint32_t count);
+uint32_t timer_get_counter(uint32_t timer_peripheral);
+void timer_update_on_overflow(uint32_t timer_peripheral);
+void timer_generate_event(uint32_t timer_peripheral, uint32_t event);
+void timer_enable_counter(uint32_t timer_peripheral);
+void timer_disable_counter(uint32_t timer_peripheral);
+void timer_enable_preload(uint32_t timer_peripheral);
+void timer_disable_preload(uint32_t timer_peripheral);
+void timer_continuous_mode(uint32_t timer_peripheral);
+void timer_enable_break_main_output(uint32_t timer_peripheral);
+void timer_set_oc_mode(uint32_t timer_peripheral, enum tim_oc_id oc_id, enum tim_oc_mode oc_mode);
+void timer_enable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_enable_oc_preload(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_set_oc_value(uint32_t timer_peripheral, enum tim_oc_id oc_id, uint32_t value);
+void timer_slave_set_mode(uint32_t timer_peripheral, uint8_t mode);
+void timer_slave_set_trigger(uint32_t timer_peripheral, uint8_t trigger);
+void timer_set_master_mode(uint32_t timer_peripheral, uint32_t mode);
+void timer_ic_set_input(uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_input in);
+void timer_ic_set_filter(uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_filter flt);
+void timer_ic_set_polarity(uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_pol pol);
+void timer_ic_enable(uint32_t timer_peripheral, enum tim_ic_id ic);
+bool timer_get_flag(uint32_t timer_peripheral, uint32_t flag);
+void timer_clear_flag(uint32_t timer_peripheral, uint32_t flag);
+void timer_enable_irq(uint32_t timer_peripheral, uint32_t irq);
+void timer_disable_irq(uint32_t timer_peripheral, uint32_t irq);
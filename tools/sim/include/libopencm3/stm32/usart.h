@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define USART1 0x40013800U
+
+volatile uint32_t *sim_usart_reg(uint32_t usart, uint32_t offset);
+
+#define USART_CR3(usart) (*sim_usart_reg((usart), 0x08))
+#define USART_ICR(usart) (*sim_usart_reg((usart), 0x20))
+
+#define USART_CR1_TXEIE (1 << 7)
+#define USART_CR1_RXNEIE (1 << 5)
+#define USART_CR1_TE (1 << 3)
+#define USART_CR1_RE (1 << 2)
+#define USART_CR1_UE (1 << 0)
+
+#define USART_CR3_HDSEL (1 << 3)
+
+#define USART_ISR_TXE (1 << 7)
+#define USART_ISR_TC (1 << 6)
+#define USART_ISR_RXNE (1 << 5)
+#define USART_ISR_ORE (1 << 3)
+#define USART_ISR_FE (1 << 1)
+
+#define USART_ICR_ORECF (1 << 3)
+#define USART_ICR_FECF (1 << 1)
+
+#define USART_STOPBITS_1 (0 << 12)
+#define USART_PARITY_NONE 0
+#define USART_MODE_RX (1 << 2)
+#define USART_MODE_TX (1 << 3)
+#define USART_MODE_TX_RX (USART_MODE_RX | USART_MODE_TX)
+#define USART_FLOWCONTROL_NONE 0
+
+void usart_set_baudrate(uint32_t usart, uint32_t baud);
+void usart_set_databits(uint32_t usart, uint32_t bits);
+void usart_set_stopbits(uint32_t usart, uint32_t stopbits);
+void usart_set_parity(uint32_t usart, uint32_t parity);
+void usart_set_mode(uint32_t usart, uint32_t mode);
+void usart_set_flow_control(uint32_t usart, uint32_t flowcontrol);
+void usart_enable(uint32_t usart);
+void usart_enable_rx_interrupt(uint32_t usart);
+void usart_enable_tx_interrupt(uint32_t usart);
+void usart_disable_tx_interrupt(uint32_t usart);
+void usart_send(uint32_t usart, uint16_t data);
+uint16_t usart_recv(uint32_t usart);
+bool usart_get_flag(uint32_t usart, uint32_t flag);
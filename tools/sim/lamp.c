@@ -0,0 +1,457 @@
+/*
+ * lamp - run the firmware on the simulated hardware
+ *
+ * Usage: lamp [-b] [-o trace.txt] [-e clock_error] [-d power_on_ms]
+ *	[-s samples.txt] [-r bus] [-t bus]... [-j jitter_us] scenario.txt
+ *
+ * main.c is built with main() renamed to firmware_main() and runs
+ * unchanged until the scenario ends. TIM1 register writes go to
+ * the trace, ready for tools/pwmscope. clock_error is the relative
+ * HSI frequency error, e.g. 0.01 for 1% fast. With -b the run fails
+ * unless the first TIM1 output edge came before main() left the HSI
+ * clock, and diag reported the boot time within BOOT_REPORT_MAX_US
+ * after that edge.
+ *
+ * The lamp powers on power_on_ms into the simulation. Every 50us the
+ * samples file gets a "<ns> <brightness> <temperature> <phase>" line,
+ * phase is the TIM1 position within its period from 0 to 1.
+ *
+ * Bytes on the USART1 sync bus are exchanged as "<ns> <byte>" lines,
+ * the time of the start bit. -t writes the sent ones, -r reads the
+ * ones to receive, e.g. from a FIFO another lamp writes to. See
+ * sync_sim.c.
+ *
+ * A simulated camera drives the TIM3 CH2 frame trigger, each edge
+ * off by up to jitter_us either way. Shutter builds report every
+ * change of the lock and, at the end, where the frame edges fell
+ * within the PWM period. They fail unless every lock matched the
+ * camera's frame period and came within SHUTTER_LOCK_MAX_MS of it
+ * (re)starting, the lamp is locked at the end and the measured
+ * jitter stays within the camera's.
+ *
+ * Scenario lines, times in ms since the start of the simulation:
+ *	<time> press|release dimmer|brighter|warmer|colder
+ *	<time> camera <frame rate>, 0 stops the camera
+ *	<time> end
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libopencm3/stm32/timer.h>
+
+#include "diag.h"
+#include "gpiod.h"
+#include "pwm.h"
+#include "sim.h"
+#include "velocity.h"
+
+#define NS_PER_MS 1000000ULL
+#define SAMPLE_NS 50000ULL
+#define BUS_OUTPUTS_MAX 8
+#define CAMERA_CHANGES_MAX 16
+#define SHUTTER_MONITOR_NS 1000000ULL
+// Three polls of shutter.c
+#define SHUTTER_LOCK_MAX_MS 300
+// A few calls at the HSI clock between the output enable and diag
+#define BOOT_REPORT_MAX_US 20
+
+typedef struct {
+	const char *name;
+	uint8_t gpio;
+} button_t;
+
+static const button_t buttons_g[] = {
+#if !ENCODER_ENABLE
+	{ "dimmer", GPIO_DIMMER },
+	{ "brighter", GPIO_BRIGHTER },
+#endif
+	{ "warmer", GPIO_WARMER },
+	{ "colder", GPIO_COLDER },
+};
+
+static FILE *trace_g;
+static bool check_boot_g;
+static uint64_t power_on_ns_g;
+static FILE *samples_g;
+static FILE *bus_in_g;
+static FILE *bus_out_g[BUS_OUTPUTS_MAX];
+static unsigned bus_outputs_g;
+
+typedef struct {
+	// 0 while stopped
+	double period_ns;
+	// Nominal time of the next frame edge
+	double next_ns;
+	double jitter_us;
+	// Edges scheduled before the last frame rate change are dropped
+	uintptr_t generation;
+	uint64_t started_ns;
+	// Locked since the last frame rate change
+	bool locked;
+	unsigned locked_edges;
+	bool slow_lock;
+	bool wrong_lock;
+	uint32_t seed;
+	// Frame edge position relative to the PWM period start while locked
+	double edge_min_us;
+	double edge_max_us;
+	bool edges;
+} camera_t;
+
+static double camera_fps_g[CAMERA_CHANGES_MAX];
+static unsigned camera_changes_g;
+static camera_t camera_g = { .seed = 1 };
+
+int firmware_main(void);
+
+static void press_cb(void *ctx) {
+	const button_t *button = ctx;
+
+	// Buttons pull to ground
+	sim_gpio_input(gpiod_get_port(button->gpio), gpiod_get_gpio(button->gpio), false);
+}
+
+static void release_cb(void *ctx) {
+	const button_t *button = ctx;
+
+	sim_gpio_input(gpiod_get_port(button->gpio), gpiod_get_gpio(button->gpio), true);
+}
+
+static void sample_cb(void *ctx) {
+	(void)ctx;
+
+	fprintf(samples_g, "%" PRIu64 " %d %d %.6f\n", sim_now_ns,
+		velocity_get_value(VELOCITY_BRIGHTNESS), velocity_get_value(VELOCITY_TEMPERATURE),
+		sim_timer_phase(TIM1));
+	sim_at(sim_now_ns + SAMPLE_NS, sample_cb, NULL);
+}
+
+static void bus_send(uint8_t data) {
+	unsigned i;
+
+	for (i = 0; i < bus_outputs_g; i++) {
+		// Readers may have ended already
+		fprintf(bus_out_g[i], "%" PRIu64 " %u\n", sim_now_ns, data);
+	}
+}
+
+static void bus_receive_cb(void *ctx);
+
+// Blocks until the sender got that far, nothing more once it ended
+static void bus_receive_next(void) {
+	uint64_t time_ns;
+	unsigned data;
+
+	if (fscanf(bus_in_g, "%" SCNu64 " %u", &time_ns, &data) == 2) {
+		sim_at(time_ns > sim_now_ns ? time_ns : sim_now_ns, bus_receive_cb, (void *)(uintptr_t)data);
+	}
+}
+
+static void bus_receive_cb(void *ctx) {
+	sim_usart_line((uintptr_t)ctx);
+	bus_receive_next();
+}
+
+static FILE *open_file(const char *path, const char *mode) {
+	FILE *f = fopen(path, mode);
+
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	return f;
+}
+
+// Deterministic on every host, unlike rand()
+static double camera_jitter_ns(void) {
+	camera_g.seed ^= camera_g.seed << 13;
+	camera_g.seed ^= camera_g.seed >> 17;
+	camera_g.seed ^= camera_g.seed << 5;
+	return (camera_g.seed / 4294967295.0 * 2 - 1) * camera_g.jitter_us * 1000;
+}
+
+static void camera_edge_cb(void *ctx);
+
+static void camera_schedule(void) {
+	double edge_ns = camera_g.next_ns + camera_jitter_ns();
+
+	sim_at(edge_ns > sim_now_ns ? edge_ns : sim_now_ns, camera_edge_cb, (void *)camera_g.generation);
+}
+
+static void camera_edge_cb(void *ctx) {
+	if ((uintptr_t)ctx != camera_g.generation) {
+		return;
+	}
+
+#if SHUTTER_ENABLE
+	// The first edge after locking restarts a free running PWM
+	if (camera_g.locked && camera_g.locked_edges++) {
+		// Negative if the edge cut the last PWM period short
+		double edge_us = sim_timer_phase(TIM1);
+
+		edge_us = (edge_us >= 0.5 ? edge_us - 1 : edge_us) * PWM_PERIOD / (PWM_TIMER_FREQ / 1e6);
+		if (!camera_g.edges || edge_us < camera_g.edge_min_us) {
+			camera_g.edge_min_us = edge_us;
+		}
+		if (!camera_g.edges || edge_us > camera_g.edge_max_us) {
+			camera_g.edge_max_us = edge_us;
+		}
+		camera_g.edges = true;
+	}
+#endif
+	sim_timer_trigger(TIM3);
+
+	camera_g.next_ns += camera_g.period_ns;
+	camera_schedule();
+}
+
+static void camera_cb(void *ctx) {
+	double fps = *(double *)ctx;
+
+	camera_g.generation++;
+	camera_g.locked = false;
+	camera_g.period_ns = fps ? 1e9 / fps : 0;
+	if (fps) {
+		camera_g.started_ns = camera_g.next_ns = sim_now_ns;
+		camera_schedule();
+	}
+}
+
+#if SHUTTER_ENABLE
+// Both ends of a measured period and the locked one may be off
+static double shutter_jitter_max_us(void) {
+	return 4 * camera_g.jitter_us + 1;
+}
+
+static void shutter_monitor_cb(void *ctx) {
+	static uint16_t period_us = 0;
+
+	(void)ctx;
+
+	if (diag_g.shutter_period_us != period_us) {
+		period_us = diag_g.shutter_period_us;
+		camera_g.locked = period_us && camera_g.period_ns;
+		camera_g.locked_edges = 0;
+		if (period_us) {
+			double lock_ms = (sim_now_ns - camera_g.started_ns) / 1e6;
+			// Frame period as measured with the lamp's HSI
+			double error_us = period_us - camera_g.period_ns / 1e3 * (1 + sim_clock_error);
+
+			printf("%.1f ms: locked to %u us, divisor %u, %.1f ms after the camera started\n",
+				sim_now_ns / 1e6, period_us, diag_g.shutter_divisor, lock_ms);
+			camera_g.slow_lock |= lock_ms > SHUTTER_LOCK_MAX_MS;
+			camera_g.wrong_lock |= error_us > shutter_jitter_max_us() || -error_us > shutter_jitter_max_us();
+		} else {
+			printf("%.1f ms: unlocked\n", sim_now_ns / 1e6);
+		}
+	}
+	sim_at(sim_now_ns + SHUTTER_MONITOR_NS, shutter_monitor_cb, NULL);
+}
+
+static bool shutter_report(void) {
+	uint16_t jitter_max_us = shutter_jitter_max_us();
+
+	printf("shutter jitter:   %u us\n", diag_g.shutter_jitter_us);
+	printf("shutter relocks:  %u\n", diag_g.shutter_relocks);
+	if (camera_g.edges) {
+		printf("frame edges:      %.1f to %.1f us from the PWM period start\n",
+			camera_g.edge_min_us, camera_g.edge_max_us);
+	}
+	if (camera_g.period_ns && !diag_g.shutter_period_us) {
+		fprintf(stderr, "Shutter not locked\n");
+		return false;
+	}
+	if (camera_g.wrong_lock) {
+		fprintf(stderr, "Shutter locked to a wrong frame period\n");
+		return false;
+	}
+	if (camera_g.slow_lock) {
+		fprintf(stderr, "Shutter lock took more than %u ms\n", SHUTTER_LOCK_MAX_MS);
+		return false;
+	}
+	if (diag_g.shutter_jitter_us > jitter_max_us) {
+		fprintf(stderr, "Shutter jitter above %u us\n", jitter_max_us);
+		return false;
+	}
+	return true;
+}
+#endif
+
+static void end_cb(void *ctx) {
+	(void)ctx;
+
+	printf("boot to light:    %u us\n", (unsigned)diag_g.boot_time_us);
+	printf("first output:     %u us\n", sim_lit_hz ? (unsigned)((sim_lit_ns - power_on_ns_g) / 1000) : 0);
+	printf("lit at clock:     %u Hz\n", (unsigned)sim_lit_hz);
+	printf("brightness:       %d\n", velocity_get_value(VELOCITY_BRIGHTNESS));
+	printf("temperature:      %d\n", velocity_get_value(VELOCITY_TEMPERATURE));
+#if SHUTTER_ENABLE
+	if (!shutter_report()) {
+		exit(1);
+	}
+#endif
+	if (trace_g) {
+		fclose(trace_g);
+	}
+	if (check_boot_g && sim_lit_hz != HSI_HZ) {
+		fprintf(stderr, "Lamp not lit before the clock switch\n");
+		exit(1);
+	}
+	// Truncated to whole us, the edge must not come after its end
+	if (check_boot_g && (!diag_g.boot_time_us ||
+	                     power_on_ns_g + (diag_g.boot_time_us + 1) * 1000ULL <= sim_lit_ns)) {
+		fprintf(stderr, "Boot time reported before the light came on\n");
+		exit(1);
+	}
+	if (check_boot_g &&
+	    power_on_ns_g + diag_g.boot_time_us * 1000ULL > sim_lit_ns + BOOT_REPORT_MAX_US * 1000ULL) {
+		fprintf(stderr, "Boot time reported more than %u us after the light came on\n", BOOT_REPORT_MAX_US);
+		exit(1);
+	}
+	exit(0);
+}
+
+static const button_t *find_button(const char *name) {
+	size_t i;
+
+	for (i = 0; i < sizeof(buttons_g) / sizeof(*buttons_g); i++) {
+		if (!strcmp(buttons_g[i].name, name)) {
+			return &buttons_g[i];
+		}
+	}
+	return NULL;
+}
+
+static int load_scenario(const char *path) {
+	char line[256];
+	unsigned lineno = 0;
+	bool end = false;
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char action[16], arg[16] = "";
+		double time_ms;
+		const button_t *button;
+		int fields;
+
+		lineno++;
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+			continue;
+		}
+		fields = sscanf(line, "%lf %15s %15s", &time_ms, action, arg);
+		if (fields < 2 || time_ms < 0) {
+			fprintf(stderr, "%s:%u: malformed line\n", path, lineno);
+			fclose(f);
+			return -1;
+		}
+
+		if (!strcmp(action, "end")) {
+			sim_at(time_ms * NS_PER_MS, end_cb, NULL);
+			end = true;
+			continue;
+		}
+		if (!strcmp(action, "camera") && fields == 3 && camera_changes_g < CAMERA_CHANGES_MAX) {
+			camera_fps_g[camera_changes_g] = atof(arg);
+			sim_at(time_ms * NS_PER_MS, camera_cb, &camera_fps_g[camera_changes_g++]);
+			continue;
+		}
+		button = find_button(arg);
+		if (!button || (strcmp(action, "press") && strcmp(action, "release"))) {
+			fprintf(stderr, "%s:%u: unknown action '%s %s'\n", path, lineno, action, arg);
+			fclose(f);
+			return -1;
+		}
+		sim_at(time_ms * NS_PER_MS, strcmp(action, "press") ? release_cb : press_cb, (void *)button);
+	}
+
+	fclose(f);
+	if (!end) {
+		fprintf(stderr, "%s: no end\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [-b] [-o trace.txt] [-e clock_error] [-d power_on_ms]\n"
+		"\t[-s samples.txt] [-r bus] [-t bus]... [-j jitter_us] scenario.txt\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	int opt;
+
+	while ((opt = getopt(argc, argv, "bo:e:d:s:r:t:j:")) != -1) {
+		switch (opt) {
+		case 'b':
+			check_boot_g = true;
+			break;
+		case 'o':
+			trace_g = open_file(optarg, "w");
+			break;
+		case 'e':
+			sim_clock_error = atof(optarg);
+			break;
+		case 'd':
+			power_on_ns_g = atof(optarg) * NS_PER_MS;
+			break;
+		case 's':
+			samples_g = open_file(optarg, "w");
+			break;
+		case 'r':
+			bus_in_g = open_file(optarg, "r");
+			break;
+		case 't':
+			if (bus_outputs_g == BUS_OUTPUTS_MAX) {
+				usage(argv[0]);
+			}
+			bus_out_g[bus_outputs_g++] = open_file(optarg, "w");
+			break;
+		case 'j':
+			camera_g.jitter_us = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+	}
+
+	if (load_scenario(argv[optind])) {
+		return 1;
+	}
+	if (trace_g) {
+		sim_trace_open(trace_g);
+	}
+	if (samples_g) {
+		sim_at((power_on_ns_g + SAMPLE_NS - 1) / SAMPLE_NS * SAMPLE_NS, sample_cb, NULL);
+	}
+	if (bus_in_g) {
+		bus_receive_next();
+	}
+	if (bus_outputs_g) {
+		signal(SIGPIPE, SIG_IGN);
+		sim_usart_on_send(bus_send);
+	}
+
+#if SHUTTER_ENABLE
+	sim_at(0, shutter_monitor_cb, NULL);
+#endif
+
+	sim_advance(power_on_ns_g);
+	// Only returns through end_cb()
+	firmware_main();
+	return 1;
+}
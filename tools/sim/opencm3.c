@@ -0,0 +1,979 @@
+/*
+ * Peripheral models behind the libopencm3 stand-in headers
+ *
+ * Just close enough to the STM32F030 reference manual for the
+ * way the firmware uses each peripheral. Unsupported settings are
+ * accepted and ignored.
+ */
+
+#include "sim.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/usart.h>
+
+// Time from enabling the PLL to it being locked
+#define PLL_LOCK_NS 100000
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof(*(arr)))
+
+#define TIM_CHANNELS 4
+
+typedef struct {
+	uint32_t base;
+	uint8_t irqn;
+	uint32_t cr1;
+	uint32_t cr2;
+	uint32_t smcr;
+	uint32_t dier;
+	uint32_t sr;
+	uint32_t cnt;
+	uint32_t psc;
+	uint32_t psc_active;
+	uint32_t arr;
+	uint32_t arr_active;
+	uint32_t ccr[TIM_CHANNELS];
+	uint32_t ccr_active[TIM_CHANNELS];
+	bool ocpe[TIM_CHANNELS];
+	uint8_t ocm[TIM_CHANNELS];
+	bool cce[TIM_CHANNELS];
+	bool ic_enabled[TIM_CHANNELS];
+	uint8_t ic_filter[TIM_CHANNELS];
+	// Filtered input levels in encoder mode
+	bool ti1;
+	bool ti2;
+	// Input levels before the filter and when the filtered ones follow, 0 once they do
+	bool ti_in[2];
+	uint64_t ti_due_ns[2];
+	// Time since the last counter clock
+	double elapsed_ns;
+} sim_timer_t;
+
+typedef struct {
+	uint32_t base;
+	uint16_t idr;
+	uint16_t odr;
+} sim_gpio_t;
+
+// 8N1 only, USART1 is the only instance
+typedef struct {
+	uint32_t cr1;
+	uint32_t cr3;
+	uint32_t isr;
+	// Write only, applied on the next access of the model
+	uint32_t icr;
+	uint32_t baud;
+	uint8_t rdr;
+	uint8_t tdr;
+	bool tdr_full;
+	bool sending;
+	void (*on_send)(uint8_t data);
+} sim_usart_t;
+
+uint32_t rcc_ahb_frequency = HSI_HZ;
+uint32_t rcc_apb1_frequency = HSI_HZ;
+
+volatile uint32_t sim_exti_pr = 0;
+
+uint64_t sim_lit_ns;
+uint32_t sim_lit_hz;
+
+static FILE *trace_g;
+
+static sim_usart_t usart_g = { .isr = USART_ISR_TXE | USART_ISR_TC };
+
+// Input filter by ICxF, sampling at fDTS / div, passing N equal samples in a row
+static const struct {
+	uint8_t div;
+	uint8_t n;
+} ic_filters_g[] = {
+	{ 1, 1 }, { 1, 2 }, { 1, 4 }, { 1, 8 }, { 2, 6 }, { 2, 8 }, { 4, 6 }, { 4, 8 },
+	{ 8, 6 }, { 8, 8 }, { 16, 5 }, { 16, 6 }, { 16, 8 }, { 32, 5 }, { 32, 6 }, { 32, 8 },
+};
+
+static sim_timer_t timers_g[] = {
+	{ .base = TIM1, .irqn = NVIC_TIM1_BRK_UP_TRG_COM_IRQ, .arr = 0xffff, .arr_active = 0xffff },
+	{ .base = TIM3, .irqn = NVIC_TIM3_IRQ, .arr = 0xffff, .arr_active = 0xffff },
+	{ .base = TIM14, .irqn = NVIC_TIM14_IRQ, .arr = 0xffff, .arr_active = 0xffff },
+};
+
+// Inputs idle high, all buttons have pull-ups
+static sim_gpio_t gpios_g[] = {
+	{ .base = GPIOA, .idr = 0xffff },
+	{ .base = GPIOF, .idr = 0xffff },
+};
+
+static void sim_call(void) {
+	sim_cpu_cycles(SIM_CALL_CYCLES);
+}
+
+// TIM1 register writes in the format tools/pwmscope reads
+static void sim_trace(uint32_t base, const char *reg, uint32_t value) {
+	if (trace_g && base == TIM1) {
+		fprintf(trace_g, "%" PRIu64 " %s %" PRIu32 "\n", sim_now_ns, reg, value);
+	}
+}
+
+static void sim_trace_clock(void) {
+	sim_trace(TIM1, "clk", rcc_apb1_frequency * (1 + sim_clock_error) + 0.5);
+}
+
+void sim_trace_open(FILE *trace) {
+	trace_g = trace;
+	fprintf(trace_g, "# TIM1 register writes, see tools/pwmscope\n");
+	sim_trace_clock();
+	sim_trace(TIM1, "cc2e", 0);
+	sim_trace(TIM1, "cc3e", 0);
+	sim_trace(TIM1, "cen", 0);
+}
+
+/* RCC */
+
+static void sim_timer_reset(sim_timer_t *tim);
+
+static sim_timer_t *sim_timer(uint32_t base) {
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(timers_g); i++) {
+		if (timers_g[i].base == base) {
+			return &timers_g[i];
+		}
+	}
+	fprintf(stderr, "sim: unknown timer 0x%08x\n", base);
+	exit(1);
+}
+
+void rcc_periph_clock_enable(enum rcc_periph_clken clken) {
+	(void)clken;
+	sim_call();
+}
+
+void rcc_periph_reset_pulse(enum rcc_periph_rst rst) {
+	switch (rst) {
+	case RST_TIM1:
+		sim_timer_reset(sim_timer(TIM1));
+		break;
+	case RST_TIM3:
+		sim_timer_reset(sim_timer(TIM3));
+		break;
+	case RST_TIM14:
+		sim_timer_reset(sim_timer(TIM14));
+		break;
+	case RST_USART1:
+		usart_g.cr1 = usart_g.cr3 = usart_g.icr = 0;
+		usart_g.isr = USART_ISR_TXE | USART_ISR_TC;
+		usart_g.tdr_full = false;
+		break;
+	default:
+		break;
+	}
+	sim_call();
+}
+
+void rcc_clock_setup_in_hsi_out_48mhz(void) {
+	sim_call();
+	sim_advance(PLL_LOCK_NS);
+	rcc_ahb_frequency = 48000000;
+	rcc_apb1_frequency = 48000000;
+	sim_trace_clock();
+}
+
+/* Timers */
+
+static void sim_timer_reset(sim_timer_t *tim) {
+	uint32_t base = tim->base;
+	uint8_t irqn = tim->irqn;
+
+	memset(tim, 0, sizeof(*tim));
+	tim->base = base;
+	tim->irqn = irqn;
+	tim->arr = tim->arr_active = 0xffff;
+}
+
+static bool sim_timer_encoder_mode(const sim_timer_t *tim) {
+	uint32_t sms = tim->smcr & 7;
+
+	return sms >= TIM_SMCR_SMS_EM1 && sms <= TIM_SMCR_SMS_EM3;
+}
+
+// Level of a PWM1 or PWM2 output, counting down it is active at CNT == CCR
+static bool sim_timer_output(const sim_timer_t *tim, unsigned ch) {
+	uint32_t ccr = tim->ccr_active[ch];
+	bool below = tim->cr1 & TIM_CR1_DIR_DOWN ? tim->cnt <= ccr : tim->cnt < ccr;
+
+	if (!tim->cce[ch]) {
+		return false;
+	}
+	if (tim->ocm[ch] == TIM_OCM_PWM1) {
+		return below;
+	}
+	if (tim->ocm[ch] == TIM_OCM_PWM2) {
+		return !below;
+	}
+	return tim->ocm[ch] == TIM_OCM_FORCE_HIGH;
+}
+
+// Remembers when and at which clock a TIM1 output first went active
+static void sim_timer_check_lit(const sim_timer_t *tim, uint64_t now_ns) {
+	unsigned ch;
+
+	if (sim_lit_hz || tim->base != TIM1) {
+		return;
+	}
+	for (ch = 0; ch < TIM_CHANNELS; ch++) {
+		if (sim_timer_output(tim, ch)) {
+			sim_lit_ns = now_ns;
+			sim_lit_hz = rcc_ahb_frequency;
+			return;
+		}
+	}
+}
+
+static void sim_timer_update_event(sim_timer_t *tim, bool set_flag) {
+	unsigned i;
+
+	tim->psc_active = tim->psc;
+	tim->arr_active = tim->arr;
+	for (i = 0; i < TIM_CHANNELS; i++) {
+		tim->ccr_active[i] = tim->ccr[i];
+	}
+	sim_timer_check_lit(tim, sim_now_ns);
+	if (!set_flag) {
+		return;
+	}
+	tim->sr |= TIM_SR_UIF;
+	if (tim->dier & TIM_DIER_UIE) {
+		sim_irq_raise(tim->irqn);
+	}
+}
+
+// One counter clock, edge or centre aligned
+static void sim_timer_tick(sim_timer_t *tim) {
+	if (!(tim->cr1 & TIM_CR1_CMS_MASK)) {
+		if (tim->cnt >= tim->arr_active) {
+			tim->cnt = 0;
+			sim_timer_update_event(tim, true);
+		} else {
+			tim->cnt++;
+		}
+		return;
+	}
+
+	if (tim->cr1 & TIM_CR1_DIR_DOWN) {
+		if (tim->cnt) {
+			tim->cnt--;
+		}
+		if (!tim->cnt) {
+			tim->cr1 &= ~TIM_CR1_DIR_DOWN;
+			sim_timer_update_event(tim, true);
+		}
+	} else {
+		tim->cnt++;
+		if (tim->cnt >= tim->arr_active) {
+			tim->cr1 |= TIM_CR1_DIR_DOWN;
+			sim_timer_update_event(tim, true);
+		}
+	}
+}
+
+static void sim_timer_encoder_filter(sim_timer_t *tim, uint64_t end_ns);
+
+static void sim_timer_advance(sim_timer_t *tim, uint64_t ns) {
+	double tick_ns;
+
+	sim_timer_encoder_filter(tim, sim_now_ns + ns);
+	if (!(tim->cr1 & TIM_CR1_CEN) || sim_timer_encoder_mode(tim)) {
+		return;
+	}
+
+	tim->elapsed_ns += ns;
+	for (;;) {
+		tick_ns = 1e9 * (tim->psc_active + 1) / (rcc_apb1_frequency * (1 + sim_clock_error));
+		if (tim->elapsed_ns < tick_ns) {
+			break;
+		}
+		tim->elapsed_ns -= tick_ns;
+		sim_timer_tick(tim);
+		// Before sim_now_ns moves on, see sim_advance()
+		sim_timer_check_lit(tim, sim_now_ns + ns - tim->elapsed_ns);
+	}
+}
+
+static void sim_timer_count(sim_timer_t *tim, bool down) {
+	if (down) {
+		tim->cnt = tim->cnt ? tim->cnt - 1 : tim->arr_active;
+	} else {
+		tim->cnt = tim->cnt >= tim->arr_active ? 0 : tim->cnt + 1;
+	}
+}
+
+// Counts like the encoder interface table of the reference manual
+static void sim_timer_encoder_edge(sim_timer_t *tim, bool ti1, bool ti2) {
+	uint32_t sms = tim->smcr & 7;
+	bool ti1_edge = ti1 != tim->ti1;
+	bool ti2_edge = ti2 != tim->ti2;
+
+	tim->ti1 = ti1;
+	tim->ti2 = ti2;
+	// Both filtered inputs changing on the same sample is not a valid transition
+	if (!(tim->cr1 & TIM_CR1_CEN) || !sim_timer_encoder_mode(tim) || (ti1_edge && ti2_edge)) {
+		return;
+	}
+
+	if (ti1_edge && sms != TIM_SMCR_SMS_EM2) {
+		// Counts up on TI1 rising while TI2 is low
+		sim_timer_count(tim, ti1 == ti2);
+	}
+	if (ti2_edge && sms != TIM_SMCR_SMS_EM1) {
+		// Counts up on TI2 rising while TI1 is high
+		sim_timer_count(tim, ti1 != ti2);
+	}
+}
+
+// Time of the Nth sample of a new input level at now_ns, 0 without a filter
+static uint64_t sim_timer_filter_due(const sim_timer_t *tim, unsigned ch, uint64_t now_ns) {
+	uint8_t icf = tim->ic_filter[ch];
+	double sample_ns;
+	double first_ns;
+
+	if (!icf) {
+		return 0;
+	}
+	// fDTS is the timer clock with CKD at 0
+	sample_ns = 1e9 * ic_filters_g[icf].div / (rcc_apb1_frequency * (1 + sim_clock_error));
+	first_ns = (uint64_t)(now_ns / sample_ns) * sample_ns;
+	if (first_ns < now_ns) {
+		first_ns += sample_ns;
+	}
+	return first_ns + (ic_filters_g[icf].n - 1) * sample_ns + 0.5;
+}
+
+// Passes filtered input changes due before end_ns, in order
+static void sim_timer_encoder_filter(sim_timer_t *tim, uint64_t end_ns) {
+	for (;;) {
+		uint64_t due0 = tim->ti_due_ns[0];
+		uint64_t due1 = tim->ti_due_ns[1];
+		bool pass0 = due0 && due0 < end_ns && (!due1 || due0 <= due1);
+		bool pass1 = due1 && due1 < end_ns && (!due0 || due1 <= due0);
+
+		if (!pass0 && !pass1) {
+			return;
+		}
+		if (pass0) {
+			tim->ti_due_ns[0] = 0;
+		}
+		if (pass1) {
+			tim->ti_due_ns[1] = 0;
+		}
+		sim_timer_encoder_edge(tim, pass0 ? tim->ti_in[0] : tim->ti1, pass1 ? tim->ti_in[1] : tim->ti2);
+	}
+}
+
+/*
+ * New levels of the encoder inputs, one of them may change per call.
+ * With a filter set by timer_ic_set_filter() a level only counts once
+ * it was sampled N times in a row, shorter pulses are dropped.
+ */
+void sim_timer_encoder(uint32_t timer_peripheral, bool ti1, bool ti2) {
+	sim_timer_t *tim = sim_timer(timer_peripheral);
+	bool in[2] = { ti1, ti2 };
+	bool filtered[2] = { tim->ti1, tim->ti2 };
+	unsigned ch;
+
+	if (ti1 != tim->ti_in[0] && ti2 != tim->ti_in[1]) {
+		fprintf(stderr, "sim: both encoder inputs changed at once\n");
+		exit(1);
+	}
+	for (ch = 0; ch < 2; ch++) {
+		if (in[ch] == tim->ti_in[ch]) {
+			continue;
+		}
+		tim->ti_in[ch] = in[ch];
+		// Back before the filter passed the change
+		tim->ti_due_ns[ch] = in[ch] == filtered[ch] ? 0 : sim_timer_filter_due(tim, ch, sim_now_ns);
+		if (in[ch] != filtered[ch] && !tim->ti_due_ns[ch]) {
+			sim_timer_encoder_edge(tim, ch == 0 ? ti1 : tim->ti1, ch == 1 ? ti2 : tim->ti2);
+		}
+	}
+}
+
+// Counter reset by UG or a trigger
+static void sim_timer_restart(sim_timer_t *tim) {
+	tim->cnt = 0;
+	tim->cr1 &= ~TIM_CR1_DIR_DOWN;
+	// The prescaler counter restarts as well
+	tim->elapsed_ns = 0;
+	sim_timer_update_event(tim, !(tim->cr1 & TIM_CR1_URS));
+}
+
+// Slave timers reset by TRGO, internal trigger connections of the F030
+static const struct {
+	uint32_t master;
+	uint32_t slave;
+	uint32_t trigger;
+} sim_itr_g[] = {
+	{ TIM3, TIM1, TIM_SMCR_TS_ITR2 },
+};
+
+static void sim_timer_trgo_reset(const sim_timer_t *master) {
+	size_t i;
+
+	if ((master->cr2 & (7 << 4)) != TIM_CR2_MMS_RESET) {
+		return;
+	}
+	for (i = 0; i < ARRAY_SIZE(sim_itr_g); i++) {
+		sim_timer_t *slave;
+
+		if (sim_itr_g[i].master != master->base) {
+			continue;
+		}
+		slave = sim_timer(sim_itr_g[i].slave);
+		if ((slave->cr1 & TIM_CR1_CEN) && (slave->smcr & 7) == TIM_SMCR_SMS_RM &&
+				(slave->smcr & (7 << 4)) == sim_itr_g[i].trigger) {
+			sim_timer_restart(slave);
+			sim_trace(slave->base, "ug", 1);
+		}
+	}
+}
+
+/*
+ * Rising edge on TI2. Captures into CCR2 if IC2 is enabled and
+ * resets the counter in reset slave mode on TI2FP2, passing the
+ * reset on via TRGO. Input filters are not modelled.
+ */
+void sim_timer_trigger(uint32_t timer_peripheral) {
+	sim_timer_t *tim = sim_timer(timer_peripheral);
+
+	if (!(tim->cr1 & TIM_CR1_CEN)) {
+		return;
+	}
+	if (tim->ic_enabled[TIM_IC2]) {
+		if (tim->sr & TIM_SR_CC2IF) {
+			tim->sr |= TIM_SR_CC2OF;
+		}
+		tim->ccr[1] = tim->cnt;
+		tim->sr |= TIM_SR_CC2IF;
+		if (tim->dier & TIM_DIER_CC2IE) {
+			sim_irq_raise(tim->irqn);
+		}
+	}
+	if ((tim->smcr & 7) == TIM_SMCR_SMS_RM && (tim->smcr & (7 << 4)) == TIM_SMCR_TS_TI2FP2) {
+		sim_timer_restart(tim);
+		sim_timer_trgo_reset(tim);
+	}
+}
+
+// Position within the current period from 0 to 1, no cost in CPU time
+double sim_timer_phase(uint32_t timer_peripheral) {
+	const sim_timer_t *tim = sim_timer(timer_peripheral);
+	double period;
+
+	if (!(tim->cr1 & TIM_CR1_CMS_MASK)) {
+		return (double)tim->cnt / (tim->arr_active + 1);
+	}
+	period = 2.0 * tim->arr_active;
+	if ((tim->cr1 & TIM_CR1_DIR_DOWN) && tim->cnt) {
+		return (period - tim->cnt) / period;
+	}
+	return tim->cnt / period;
+}
+
+volatile uint32_t *sim_timer_reg(uint32_t timer_peripheral, uint32_t offset) {
+	sim_timer_t *tim = sim_timer(timer_peripheral);
+
+	switch (offset) {
+	case 0x00:
+		return &tim->cr1;
+	case 0x38:
+		return &tim->ccr[1];
+	default:
+		fprintf(stderr, "sim: timer register 0x%02x not modelled\n", offset);
+		exit(1);
+	}
+}
+
+void timer_set_mode(uint32_t timer_peripheral, uint32_t clock_div, uint32_t alignment, uint32_t direction) {
+	sim_timer_t *tim = sim_timer(timer_peripheral);
+
+	(void)clock_div;
+	tim->cr1 = (tim->cr1 & ~(TIM_CR1_CMS_MASK | TIM_CR1_DIR_DOWN)) | alignment | direction;
+	sim_trace(timer_peripheral, "cms", alignment >> 5);
+	sim_call();
+}
+
+void timer_set_prescaler(uint32_t timer_peripheral, uint32_t value) {
+	sim_timer(timer_peripheral)->psc = value;
+	sim_trace(timer_peripheral, "psc", value);
+	sim_call();
+}
+
+void timer_set_period(uint32_t timer_peripheral, uint32_t period) {
+	sim_timer_t *tim = sim_timer(timer_peripheral);
+
+	tim->arr = period;
+	if (!(tim->cr1 & TIM_CR1_ARPE)) {
+		tim->arr_active = period;
+	}
+	sim_trace(timer_peripheral, "arr", period);
+	sim_call();
+}
+
+void timer_set_counter(uint32_t timer_peripheral, uint32_t count) {
+	sim_timer(timer_peripheral)->cnt = count;
+	sim_call();
+}
+
+uint32_t timer_get_counter(uint32_t timer_peripheral) {
+	sim_call();
+	return sim_timer(timer_peripheral)->cnt;
+}
+
+void timer_update_on_overflow(uint32_t timer_peripheral) {
+	sim_timer(timer_peripheral)->cr1 |= TIM_CR1_URS;
+	sim_call();
+}
+
+void timer_generate_event(uint32_t timer_peripheral, uint32_t event) {
+	sim_timer_t *tim = sim_timer(timer_peripheral);
+
+	if (event & TIM_EGR_UG) {
+		sim_timer_restart(tim);
+		sim_trace(timer_peripheral, "ug", 1);
+		sim_timer_trgo_reset(tim);
+	}
+	sim_call();
+}
+
+void timer_enable_counter(uint32_t timer_peripheral) {
+	sim_timer(timer_peripheral)->cr1 |= TIM_CR1_CEN;
+	sim_trace(timer_peripheral, "cen", 1);
+	sim_call();
+}
+
+void timer_disable_counter(uint32_t timer_peripheral) {
+	sim_timer(timer_peripheral)->cr1 &= ~TIM_CR1_CEN;
+	sim_trace(timer_peripheral, "cen", 0);
+	sim_call();
+}
+
+void timer_enable_preload(uint32_t timer_peripheral) {
+	sim_timer(timer_peripheral)->cr1 |= TIM_CR1_ARPE;
+	sim_trace(timer_peripheral, "arpe", 1);
+	sim_call();
+}
+
+void timer_disable_preload(uint32_t timer_peripheral) {
+	sim_timer(timer_peripheral)->cr1 &= ~TIM_CR1_ARPE;
+	sim_trace(timer_peripheral, "arpe", 0);
+	sim_call();
+}
+
+void timer_continuous_mode(uint32_t timer_peripheral) {
+	(void)timer_peripheral;
+	sim_call();
+}
+
+void timer_enable_break_main_output(uint32_t timer_peripheral) {
+	(void)timer_peripheral;
+	sim_call();
+}
+
+void timer_set_oc_mode(uint32_t timer_peripheral, enum tim_oc_id oc_id, enum tim_oc_mode oc_mode) {
+	sim_timer_t *tim = sim_timer(timer_peripheral);
+
+	tim->ocm[oc_id / 2] = oc_mode;
+	sim_timer_check_lit(tim, sim_now_ns);
+	if (oc_id == TIM_OC2) {
+		sim_trace(timer_peripheral, "ocm2", oc_mode);
+	} else if (oc_id == TIM_OC3) {
+		sim_trace(timer_peripheral, "ocm3", oc_mode);
+	}
+	sim_call();
+}
+
+void timer_enable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id) {
+	sim_timer_t *tim = sim_timer(timer_peripheral);
+
+	tim->cce[oc_id / 2] = true;
+	sim_timer_check_lit(tim, sim_now_ns);
+	if (oc_id == TIM_OC2) {
+		sim_trace(timer_peripheral, "cc2e", 1);
+	} else if (oc_id == TIM_OC3) {
+		sim_trace(timer_peripheral, "cc3e", 1);
+	}
+	sim_call();
+}
+
+void timer_enable_oc_preload(uint32_t timer_peripheral, enum tim_oc_id oc_id) {
+	sim_timer(timer_peripheral)->ocpe[oc_id / 2] = true;
+	// pwmscope only knows one preload setting for both channels
+	sim_trace(timer_peripheral, "ocpe", 1);
+	sim_call();
+}
+
+void timer_set_oc_value(uint32_t timer_peripheral, enum tim_oc_id oc_id, uint32_t value) {
+	sim_timer_t *tim = sim_timer(timer_peripheral);
+	unsigned ch = oc_id / 2;
+
+	// Rewriting the same value is a no-op, keeps the trace short
+	if (oc_id == TIM_OC2 && value != tim->ccr[ch]) {
+		sim_trace(timer_peripheral, "ccr2", value);
+	} else if (oc_id == TIM_OC3 && value != tim->ccr[ch]) {
+		sim_trace(timer_peripheral, "ccr3", value);
+	}
+	tim->ccr[ch] = value;
+	if (!tim->ocpe[ch]) {
+		tim->ccr_active[ch] = value;
+		sim_timer_check_lit(tim, sim_now_ns);
+	}
+	sim_call();
+}
+
+void timer_slave_set_mode(uint32_t timer_peripheral, uint8_t mode) {
+	sim_timer_t *tim = sim_timer(timer_peripheral);
+
+	tim->smcr = (tim->smcr & ~7) | mode;
+	sim_call();
+}
+
+void timer_slave_set_trigger(uint32_t timer_peripheral, uint8_t trigger) {
+	sim_timer_t *tim = sim_timer(timer_peripheral);
+
+	tim->smcr = (tim->smcr & ~(7 << 4)) | trigger;
+	sim_call();
+}
+
+void timer_set_master_mode(uint32_t timer_peripheral, uint32_t mode) {
+	sim_timer_t *tim = sim_timer(timer_peripheral);
+
+	tim->cr2 = (tim->cr2 & ~(7 << 4)) | mode;
+	sim_call();
+}
+
+void timer_ic_set_input(uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_input in) {
+	(void)timer_peripheral;
+	(void)ic;
+	(void)in;
+	sim_call();
+}
+
+void timer_ic_set_filter(uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_filter flt) {
+	sim_timer(timer_peripheral)->ic_filter[ic] = flt;
+	sim_call();
+}
+
+void timer_ic_set_polarity(uint32_t timer_peripheral, enum tim_ic_id ic, enum tim_ic_pol pol) {
+	(void)timer_peripheral;
+	(void)ic;
+	(void)pol;
+	sim_call();
+}
+
+void timer_ic_enable(uint32_t timer_peripheral, enum tim_ic_id ic) {
+	sim_timer(timer_peripheral)->ic_enabled[ic] = true;
+	sim_call();
+}
+
+bool timer_get_flag(uint32_t timer_peripheral, uint32_t flag) {
+	sim_call();
+	return sim_timer(timer_peripheral)->sr & flag;
+}
+
+void timer_clear_flag(uint32_t timer_peripheral, uint32_t flag) {
+	sim_timer(timer_peripheral)->sr &= ~flag;
+	sim_call();
+}
+
+void timer_enable_irq(uint32_t timer_peripheral, uint32_t irq) {
+	sim_timer(timer_peripheral)->dier |= irq;
+	sim_call();
+}
+
+void timer_disable_irq(uint32_t timer_peripheral, uint32_t irq) {
+	sim_timer(timer_peripheral)->dier &= ~irq;
+	sim_call();
+}
+
+/* GPIO */
+
+static sim_gpio_t *sim_gpio(uint32_t base) {
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(gpios_g); i++) {
+		if (gpios_g[i].base == base) {
+			return &gpios_g[i];
+		}
+	}
+	fprintf(stderr, "sim: unknown gpio port 0x%08x\n", base);
+	exit(1);
+}
+
+void sim_gpio_input(uint32_t port, uint16_t gpios, bool level) {
+	sim_gpio_t *gpio = sim_gpio(port);
+
+	gpio->idr = level ? gpio->idr | gpios : gpio->idr & ~gpios;
+}
+
+void gpio_mode_setup(uint32_t gpioport, uint8_t mode, uint8_t pull_up_down, uint16_t gpios) {
+	(void)gpioport;
+	(void)mode;
+	(void)pull_up_down;
+	(void)gpios;
+	sim_call();
+}
+
+void gpio_set_output_options(uint32_t gpioport, uint8_t otype, uint8_t speed, uint16_t gpios) {
+	(void)gpioport;
+	(void)otype;
+	(void)speed;
+	(void)gpios;
+	sim_call();
+}
+
+void gpio_set_af(uint32_t gpioport, uint8_t alt_func_num, uint16_t gpios) {
+	(void)gpioport;
+	(void)alt_func_num;
+	(void)gpios;
+	sim_call();
+}
+
+void gpio_set(uint32_t gpioport, uint16_t gpios) {
+	sim_gpio(gpioport)->odr |= gpios;
+	sim_call();
+}
+
+void gpio_clear(uint32_t gpioport, uint16_t gpios) {
+	sim_gpio(gpioport)->odr &= ~gpios;
+	sim_call();
+}
+
+uint16_t gpio_get(uint32_t gpioport, uint16_t gpios) {
+	sim_call();
+	return sim_gpio(gpioport)->idr & gpios;
+}
+
+/* EXTI, edges are not modelled */
+
+void exti_set_trigger(uint32_t extis, enum exti_trigger_type trig) {
+	(void)extis;
+	(void)trig;
+	sim_call();
+}
+
+void exti_enable_request(uint32_t extis) {
+	(void)extis;
+	sim_call();
+}
+
+void exti_select_source(uint32_t exti, uint32_t gpioport) {
+	(void)exti;
+	(void)gpioport;
+	sim_call();
+}
+
+/*
+ * USART, 8N1 at the configured baud rate on the simulated HSI. A byte
+ * takes 10 bit times on the line, the receiver sets RXNE in the
+ * middle of the stop bit. Interrupts are raised when a flag gets set
+ * while its interrupt is enabled.
+ */
+
+static sim_usart_t *sim_usart(uint32_t usart) {
+	if (usart != USART1) {
+		fprintf(stderr, "sim: unknown usart 0x%08x\n", usart);
+		exit(1);
+	}
+	// Clear flags written to ICR since the last access
+	usart_g.isr &= ~usart_g.icr;
+	usart_g.icr = 0;
+	return &usart_g;
+}
+
+static double sim_usart_bit_ns(const sim_usart_t *usart) {
+	return 1e9 / (usart->baud * (1 + sim_clock_error));
+}
+
+static void sim_usart_flag(sim_usart_t *usart, uint32_t flag) {
+	usart->isr |= flag;
+	if (((flag & USART_ISR_TXE) && (usart->cr1 & USART_CR1_TXEIE)) ||
+			((flag & (USART_ISR_RXNE | USART_ISR_ORE)) && (usart->cr1 & USART_CR1_RXNEIE))) {
+		sim_irq_raise(NVIC_USART1_IRQ);
+	}
+}
+
+static void sim_usart_sent(void *ctx);
+
+// Move TDR to the shift register
+static void sim_usart_send_next(sim_usart_t *usart) {
+	usart->tdr_full = false;
+	usart->sending = true;
+	usart->isr &= ~USART_ISR_TC;
+	if (usart->on_send) {
+		usart->on_send(usart->tdr);
+	}
+	sim_at(sim_now_ns + 10 * sim_usart_bit_ns(usart) + 0.5, sim_usart_sent, usart);
+	sim_usart_flag(usart, USART_ISR_TXE);
+}
+
+static void sim_usart_sent(void *ctx) {
+	sim_usart_t *usart = ctx;
+
+	usart->sending = false;
+	if (usart->tdr_full) {
+		sim_usart_send_next(usart);
+	} else {
+		sim_usart_flag(usart, USART_ISR_TC);
+	}
+}
+
+static void sim_usart_received(void *ctx) {
+	sim_usart_t *usart = sim_usart(USART1);
+
+	// RDR keeps the unread byte on overrun
+	if (usart->isr & USART_ISR_RXNE) {
+		sim_usart_flag(usart, USART_ISR_ORE);
+		return;
+	}
+	usart->rdr = (uintptr_t)ctx;
+	sim_usart_flag(usart, USART_ISR_RXNE);
+}
+
+void sim_usart_on_send(void (*cb)(uint8_t data)) {
+	usart_g.on_send = cb;
+}
+
+void sim_usart_line(uint8_t data) {
+	const uint32_t rx = USART_CR1_UE | USART_CR1_RE;
+	sim_usart_t *usart = sim_usart(USART1);
+
+	if ((usart->cr1 & rx) == rx) {
+		sim_at(sim_now_ns + 9.5 * sim_usart_bit_ns(usart) + 0.5, sim_usart_received, (void *)(uintptr_t)data);
+	}
+}
+
+volatile uint32_t *sim_usart_reg(uint32_t usart, uint32_t offset) {
+	sim_usart_t *model = sim_usart(usart);
+
+	switch (offset) {
+	case 0x08:
+		return &model->cr3;
+	case 0x20:
+		return &model->icr;
+	default:
+		fprintf(stderr, "sim: usart register 0x%02x not modelled\n", offset);
+		exit(1);
+	}
+}
+
+void usart_set_baudrate(uint32_t usart, uint32_t baud) {
+	sim_usart(usart)->baud = baud;
+	sim_call();
+}
+
+void usart_set_databits(uint32_t usart, uint32_t bits) {
+	(void)usart;
+	(void)bits;
+	sim_call();
+}
+
+void usart_set_stopbits(uint32_t usart, uint32_t stopbits) {
+	(void)usart;
+	(void)stopbits;
+	sim_call();
+}
+
+void usart_set_parity(uint32_t usart, uint32_t parity) {
+	(void)usart;
+	(void)parity;
+	sim_call();
+}
+
+void usart_set_mode(uint32_t usart, uint32_t mode) {
+	sim_usart_t *model = sim_usart(usart);
+
+	model->cr1 = (model->cr1 & ~(USART_CR1_TE | USART_CR1_RE)) | mode;
+	sim_call();
+}
+
+void usart_set_flow_control(uint32_t usart, uint32_t flowcontrol) {
+	(void)usart;
+	(void)flowcontrol;
+	sim_call();
+}
+
+void usart_enable(uint32_t usart) {
+	sim_usart(usart)->cr1 |= USART_CR1_UE;
+	sim_call();
+}
+
+void usart_enable_rx_interrupt(uint32_t usart) {
+	sim_usart_t *model = sim_usart(usart);
+
+	model->cr1 |= USART_CR1_RXNEIE;
+	if (model->isr & (USART_ISR_RXNE | USART_ISR_ORE)) {
+		sim_irq_raise(NVIC_USART1_IRQ);
+	}
+	sim_call();
+}
+
+void usart_enable_tx_interrupt(uint32_t usart) {
+	sim_usart_t *model = sim_usart(usart);
+
+	model->cr1 |= USART_CR1_TXEIE;
+	if (model->isr & USART_ISR_TXE) {
+		sim_irq_raise(NVIC_USART1_IRQ);
+	}
+	sim_call();
+}
+
+void usart_disable_tx_interrupt(uint32_t usart) {
+	sim_usart(usart)->cr1 &= ~USART_CR1_TXEIE;
+	sim_call();
+}
+
+void usart_send(uint32_t usart, uint16_t data) {
+	const uint32_t tx = USART_CR1_UE | USART_CR1_TE;
+	sim_usart_t *model = sim_usart(usart);
+
+	if ((model->cr1 & tx) == tx) {
+		model->tdr = data;
+		model->tdr_full = true;
+		model->isr &= ~USART_ISR_TXE;
+		if (!model->sending) {
+			sim_usart_send_next(model);
+		}
+	}
+	sim_call();
+}
+
+uint16_t usart_recv(uint32_t usart) {
+	sim_usart_t *model = sim_usart(usart);
+
+	model->isr &= ~USART_ISR_RXNE;
+	sim_call();
+	return model->rdr;
+}
+
+bool usart_get_flag(uint32_t usart, uint32_t flag) {
+	bool set = sim_usart(usart)->isr & flag;
+
+	sim_call();
+	return set;
+}
+
+void sim_periph_advance(uint64_t ns) {
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(timers_g); i++) {
+		sim_timer_advance(&timers_g[i], ns);
+	}
+}
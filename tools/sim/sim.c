@@ -0,0 +1,163 @@
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/rcc.h>
+
+typedef struct sim_event {
+	struct sim_event *next;
+	uint64_t time_ns;
+	sim_event_f cb;
+	void *ctx;
+} sim_event_t;
+
+uint64_t sim_now_ns = 0;
+double sim_clock_error = 0;
+
+static sim_event_t *events_g;
+static double cycle_ns_frac = 0;
+
+static bool irq_masked = false;
+static bool irq_active = false;
+static uint32_t irq_enabled = 0;
+static uint32_t irq_pending = 0;
+
+// Only handlers the firmware actually defines are linked in
+#pragma weak exti0_1_isr
+#pragma weak exti2_3_isr
+#pragma weak exti4_15_isr
+#pragma weak tim1_brk_up_trg_com_isr
+#pragma weak tim3_isr
+#pragma weak tim14_isr
+#pragma weak usart1_isr
+
+static void (*sim_irq_handler(uint8_t irqn))(void) {
+	switch (irqn) {
+	case NVIC_EXTI0_1_IRQ:
+		return exti0_1_isr;
+	case NVIC_EXTI2_3_IRQ:
+		return exti2_3_isr;
+	case NVIC_EXTI4_15_IRQ:
+		return exti4_15_isr;
+	case NVIC_TIM1_BRK_UP_TRG_COM_IRQ:
+		return tim1_brk_up_trg_com_isr;
+	case NVIC_TIM3_IRQ:
+		return tim3_isr;
+	case NVIC_TIM14_IRQ:
+		return tim14_isr;
+	case NVIC_USART1_IRQ:
+		return usart1_isr;
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * All firmware interrupts share one priority, so handlers never
+ * nest. Pending ones are taken in IRQ number order, like the NVIC
+ * does for equal priorities.
+ */
+static void sim_irq_dispatch(void) {
+	uint8_t irqn;
+
+	while (!irq_masked && !irq_active && (irq_pending & irq_enabled)) {
+		for (irqn = 0; !(irq_pending & irq_enabled & (1U << irqn)); irqn++) {
+		}
+		irq_pending &= ~(1U << irqn);
+		if (!sim_irq_handler(irqn)) {
+			fprintf(stderr, "sim: no handler for enabled IRQ %u\n", irqn);
+			exit(1);
+		}
+		irq_active = true;
+		sim_irq_handler(irqn)();
+		irq_active = false;
+	}
+}
+
+void sim_irq_raise(uint8_t irqn) {
+	irq_pending |= 1U << irqn;
+}
+
+void sim_at(uint64_t time_ns, sim_event_f cb, void *ctx) {
+	sim_event_t **pos = &events_g;
+	sim_event_t *event = malloc(sizeof(*event));
+
+	if (!event) {
+		perror("malloc");
+		exit(1);
+	}
+	event->time_ns = time_ns;
+	event->cb = cb;
+	event->ctx = ctx;
+
+	// Events due at the same time run in the order they were added
+	while (*pos && (*pos)->time_ns <= time_ns) {
+		pos = &(*pos)->next;
+	}
+	event->next = *pos;
+	*pos = event;
+}
+
+void sim_advance(uint64_t ns) {
+	uint64_t target = sim_now_ns + ns;
+
+	for (;;) {
+		uint64_t next = target;
+
+		if (events_g && events_g->time_ns < next) {
+			next = events_g->time_ns;
+		}
+		if (next > sim_now_ns) {
+			sim_periph_advance(next - sim_now_ns);
+			sim_now_ns = next;
+		}
+		while (events_g && events_g->time_ns <= sim_now_ns) {
+			sim_event_t *event = events_g;
+
+			events_g = event->next;
+			event->cb(event->ctx);
+			free(event);
+		}
+		sim_irq_dispatch();
+		if (sim_now_ns >= target) {
+			break;
+		}
+	}
+}
+
+void sim_cpu_cycles(uint32_t cycles) {
+	uint64_t ns;
+
+	cycle_ns_frac += cycles * 1e9 / (rcc_ahb_frequency * (1 + sim_clock_error));
+	ns = cycle_ns_frac;
+	cycle_ns_frac -= ns;
+	sim_advance(ns);
+}
+
+void nvic_set_priority(uint8_t irqn, uint8_t priority) {
+	(void)irqn;
+	(void)priority;
+	sim_cpu_cycles(SIM_CALL_CYCLES);
+}
+
+void nvic_enable_irq(uint8_t irqn) {
+	irq_enabled |= 1U << irqn;
+	sim_cpu_cycles(SIM_CALL_CYCLES);
+}
+
+void nvic_disable_irq(uint8_t irqn) {
+	irq_enabled &= ~(1U << irqn);
+	sim_cpu_cycles(SIM_CALL_CYCLES);
+}
+
+void cm_disable_interrupts(void) {
+	irq_masked = true;
+}
+
+void cm_enable_interrupts(void) {
+	irq_masked = false;
+	sim_irq_dispatch();
+}
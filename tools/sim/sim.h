@@ -0,0 +1,45 @@
+#pragma once
+
+/*
+ * Host simulation of the ringlight hardware
+ *
+ * Firmware sources are built unmodified against the libopencm3
+ * stand-in headers in include/. Each call into them costs
+ * SIM_CALL_CYCLES CPU cycles of virtual time. That is the only
+ * thing advancing the clock, apart from explicit sim_advance()
+ * calls, so every simulation run is deterministic.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SIM_CALL_CYCLES 40
+// System clock out of reset
+#define HSI_HZ 8000000
+
+typedef void (*sim_event_f)(void *ctx);
+
+extern uint64_t sim_now_ns;
+// Relative error of the HSI and all clocks derived from it
+extern double sim_clock_error;
+
+void sim_advance(uint64_t ns);
+void sim_cpu_cycles(uint32_t cycles);
+void sim_at(uint64_t time_ns, sim_event_f cb, void *ctx);
+void sim_irq_raise(uint8_t irqn);
+
+// Peripheral models, opencm3.c
+void sim_trace_open(FILE *trace);
+void sim_periph_advance(uint64_t ns);
+void sim_gpio_input(uint32_t port, uint16_t gpios, bool level);
+void sim_timer_encoder(uint32_t timer_peripheral, bool ti1, bool ti2);
+void sim_timer_trigger(uint32_t timer_peripheral);
+double sim_timer_phase(uint32_t timer_peripheral);
+// First time a TIM1 output went active and the system clock then, 0 if never
+extern uint64_t sim_lit_ns;
+extern uint32_t sim_lit_hz;
+// Called whenever USART1 starts sending a byte
+void sim_usart_on_send(void (*cb)(uint8_t data));
+// Start bit of a byte from another node on the USART1 line
+void sim_usart_line(uint8_t data);
@@ -0,0 +1,30 @@
+/*
+ * Stand-in for ringlight/diag.c, which needs the linker script
+ * symbols and SysTick. Boot time comes from the virtual clock.
+ */
+
+#include "diag.h"
+
+#include "sim.h"
+
+volatile diag_t diag_g;
+
+static uint64_t boot_start_ns;
+
+void diag_stack_paint(void) {
+}
+
+void diag_boot_timer_start(void) {
+	boot_start_ns = sim_now_ns;
+}
+
+void diag_boot_clock_changed(uint32_t prev_ahb_hz) {
+	(void)prev_ahb_hz;
+}
+
+void diag_boot_lit(void) {
+	diag_g.boot_time_us = (sim_now_ns - boot_start_ns) / 1000;
+}
+
+void diag_init(void) {
+}
@@ -0,0 +1,338 @@
+/*
+ * sync_sim - several lamps on one simulated sync bus
+ *
+ * Usage: sync_sim [-e leader_clock_error] leader.txt follower.txt
+ *	clock_error@power_on_ms...
+ *
+ * Runs ./lamp-leader with the leader scenario and one ./lamp-follower
+ * per clock_error@power_on_ms argument with the follower scenario.
+ * Both scenarios must end at the same time. The leader writes the
+ * bytes it sends into one FIFO per follower, see lamp.c.
+ *
+ * Compares the samples of each follower with the leader's:
+ *  - state latency, from the leader changing brightness or
+ *    temperature to the follower showing the same values
+ *  - phase lock time since power on, after which the PWM phase
+ *    error stays within LOCK_US
+ *  - phase error over the second half of the run
+ * Fails if a follower does not lock by then or a latency exceeds
+ * LATENCY_MAX_US.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "pwm.h"
+
+// Must match lamp.c
+#define SAMPLE_NS 50000ULL
+#define FOLLOWERS_MAX 7
+
+// 5% of the period
+#define LOCK_US 50.0
+// Sync interval of sync.c plus frame time and main loop slack
+#define LATENCY_MAX_US 21000
+
+typedef struct {
+	int brightness;
+	int temperature;
+	double phase;
+	bool valid;
+} sample_t;
+
+typedef struct {
+	double clock_error;
+	double power_on_ms;
+	sample_t *samples;
+} node_t;
+
+static char dir_g[] = "/tmp/sync_sim.XXXXXX";
+static node_t nodes_g[1 + FOLLOWERS_MAX];
+static unsigned nodes_count;
+static size_t samples_count;
+
+static void usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [-e leader_clock_error] leader.txt follower.txt clock_error@power_on_ms...\n", prog);
+	exit(1);
+}
+
+static void path(char *buf, size_t len, const char *name, unsigned node) {
+	snprintf(buf, len, "%s/%s%u", dir_g, name, node);
+}
+
+static pid_t spawn(char **argv) {
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (!pid) {
+		// Keep the per lamp summary out of ours
+		if (!freopen("/dev/null", "w", stdout)) {
+			_exit(1);
+		}
+		execv(argv[0], argv);
+		perror(argv[0]);
+		_exit(1);
+	}
+	return pid;
+}
+
+static bool run(const char *leader_scenario, const char *follower_scenario) {
+	char samples[1 + FOLLOWERS_MAX][64];
+	char bus[1 + FOLLOWERS_MAX][64];
+	char error[1 + FOLLOWERS_MAX][32];
+	char power_on[1 + FOLLOWERS_MAX][32];
+	char *argv[16 + 2 * FOLLOWERS_MAX];
+	pid_t pids[1 + FOLLOWERS_MAX];
+	bool ok = true;
+	unsigned i;
+	int argc;
+
+	for (i = 0; i < nodes_count; i++) {
+		path(samples[i], sizeof(samples[i]), "samples", i);
+		path(bus[i], sizeof(bus[i]), "bus", i);
+		snprintf(error[i], sizeof(error[i]), "%g", nodes_g[i].clock_error);
+		snprintf(power_on[i], sizeof(power_on[i]), "%g", nodes_g[i].power_on_ms);
+		if (i && mkfifo(bus[i], 0600)) {
+			perror("mkfifo");
+			return false;
+		}
+	}
+
+	for (i = 0; i < nodes_count; i++) {
+		unsigned j;
+
+		argc = 0;
+		argv[argc++] = i ? "./lamp-follower" : "./lamp-leader";
+		argv[argc++] = "-e";
+		argv[argc++] = error[i];
+		argv[argc++] = "-d";
+		argv[argc++] = power_on[i];
+		argv[argc++] = "-s";
+		argv[argc++] = samples[i];
+		if (i) {
+			argv[argc++] = "-r";
+			argv[argc++] = bus[i];
+		} else {
+			for (j = 1; j < nodes_count; j++) {
+				argv[argc++] = "-t";
+				argv[argc++] = bus[j];
+			}
+		}
+		argv[argc++] = (char *)(i ? follower_scenario : leader_scenario);
+		argv[argc] = NULL;
+		pids[i] = spawn(argv);
+	}
+
+	for (i = 0; i < nodes_count; i++) {
+		int status;
+
+		if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "Lamp %u failed\n", i);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+static bool load_samples(node_t *node, unsigned index) {
+	char name[64];
+	uint64_t time_ns;
+	sample_t sample = { .valid = true };
+	unsigned i;
+	FILE *f;
+
+	path(name, sizeof(name), "samples", index);
+	f = fopen(name, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", name, strerror(errno));
+		return false;
+	}
+	while (fscanf(f, "%" SCNu64 " %d %d %lf", &time_ns, &sample.brightness, &sample.temperature, &sample.phase) == 4) {
+		size_t k = time_ns / SAMPLE_NS;
+
+		if (k >= samples_count) {
+			size_t count = k + 1;
+
+			// All nodes share the sample grid, grow them together
+			for (i = 0; i < nodes_count; i++) {
+				nodes_g[i].samples = realloc(nodes_g[i].samples, count * sizeof(sample_t));
+				if (!nodes_g[i].samples) {
+					perror("realloc");
+					exit(1);
+				}
+				memset(nodes_g[i].samples + samples_count, 0, (count - samples_count) * sizeof(sample_t));
+			}
+			samples_count = count;
+		}
+		node->samples[k] = sample;
+	}
+	fclose(f);
+	return true;
+}
+
+static bool same_state(const sample_t *a, const sample_t *b) {
+	return a->brightness == b->brightness && a->temperature == b->temperature;
+}
+
+// Leader's PWM period in us, nominal period on its clock
+static double period_us(void) {
+	return 1e6 * PWM_PERIOD / PWM_TIMER_FREQ / (1 + nodes_g[0].clock_error);
+}
+
+static double phase_error_us(const sample_t *leader, const sample_t *follower) {
+	double error = follower->phase - leader->phase;
+
+	// Shortest way round
+	if (error >= 0.5) {
+		error -= 1;
+	} else if (error < -0.5) {
+		error += 1;
+	}
+	return error * period_us();
+}
+
+static bool report(unsigned index) {
+	const sample_t *leader = nodes_g[0].samples;
+	const sample_t *follower = nodes_g[index].samples;
+	size_t first = 0, last_unlocked = 0, steady, k;
+	unsigned changes = 0;
+	double latency_sum_us = 0, latency_max_us = 0;
+	double error_sum_us = 0, error_max_us = 0;
+	bool ok = true;
+
+	while (first < samples_count && !(follower[first].valid && leader[first].valid)) {
+		first++;
+	}
+	if (first == samples_count) {
+		fprintf(stderr, "Follower %u: no samples\n", index);
+		return false;
+	}
+
+	for (k = first + 1; k < samples_count; k++) {
+		size_t j = k;
+		double latency_us;
+
+		if (same_state(&follower[k], &follower[k - 1])) {
+			continue;
+		}
+		// Most recent time the leader changed to the follower's new state
+		while (j > first && !(same_state(&leader[j], &follower[k]) && !same_state(&leader[j - 1], &follower[k]))) {
+			j--;
+		}
+		if (j == first) {
+			fprintf(stderr, "Follower %u: state %d/%d never seen on the leader\n", index,
+				follower[k].brightness, follower[k].temperature);
+			ok = false;
+			continue;
+		}
+		latency_us = (k - j) * SAMPLE_NS / 1e3;
+		latency_sum_us += latency_us;
+		latency_max_us = latency_us > latency_max_us ? latency_us : latency_max_us;
+		changes++;
+	}
+
+	for (k = first; k < samples_count; k++) {
+		double error = phase_error_us(&leader[k], &follower[k]);
+
+		if (error > LOCK_US || error < -LOCK_US) {
+			last_unlocked = k;
+		}
+	}
+	// Settled, the trim takes a few frames more after locking
+	steady = MAX(last_unlocked + 1, samples_count / 2);
+	for (k = steady; k < samples_count; k++) {
+		double error = phase_error_us(&leader[k], &follower[k]);
+
+		error_sum_us += error;
+		error_max_us = error > error_max_us ? error : -error > error_max_us ? -error : error_max_us;
+	}
+
+	printf("follower %u: clock error %+.2f%%, power on at %g ms\n", index,
+		100 * nodes_g[index].clock_error, nodes_g[index].power_on_ms);
+	printf("  state latency:  %u changes, %.0f us mean, %.0f us worst\n", changes,
+		changes ? latency_sum_us / changes : 0, latency_max_us);
+	if (steady >= samples_count) {
+		printf("  phase:          never locked\n");
+		return false;
+	}
+	printf("  phase locked:   %.1f ms after power on, within %.0f us\n",
+		(last_unlocked + 1) * SAMPLE_NS / 1e6 - nodes_g[index].power_on_ms, LOCK_US);
+	printf("  phase error:    %.1f us mean, %.1f us worst in the last %.0f ms, %.0f us period\n",
+		error_sum_us / (samples_count - steady), error_max_us,
+		(samples_count - steady) * SAMPLE_NS / 1e6, period_us());
+
+	if (latency_max_us > LATENCY_MAX_US) {
+		fprintf(stderr, "Follower %u: state latency above %u us\n", index, LATENCY_MAX_US);
+		ok = false;
+	}
+	return ok;
+}
+
+static void cleanup(void) {
+	char name[64];
+	unsigned i;
+
+	for (i = 0; i < nodes_count; i++) {
+		path(name, sizeof(name), "samples", i);
+		unlink(name);
+		path(name, sizeof(name), "bus", i);
+		unlink(name);
+	}
+	rmdir(dir_g);
+}
+
+int main(int argc, char **argv) {
+	bool ok;
+	unsigned i;
+	int opt;
+
+	nodes_count = 1;
+	while ((opt = getopt(argc, argv, "e:")) != -1) {
+		switch (opt) {
+		case 'e':
+			nodes_g[0].clock_error = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind < 3 || argc - optind - 2 > FOLLOWERS_MAX) {
+		usage(argv[0]);
+	}
+	for (i = optind + 2; i < (unsigned)argc; i++) {
+		node_t *node = &nodes_g[nodes_count++];
+
+		if (sscanf(argv[i], "%lf@%lf", &node->clock_error, &node->power_on_ms) != 2) {
+			usage(argv[0]);
+		}
+	}
+
+	if (!mkdtemp(dir_g)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	ok = run(argv[optind], argv[optind + 1]);
+	for (i = 0; ok && i < nodes_count; i++) {
+		ok = load_samples(&nodes_g[i], i);
+	}
+	cleanup();
+	if (!ok) {
+		return 1;
+	}
+
+	printf("leader: clock error %+.2f%%\n", 100 * nodes_g[0].clock_error);
+	for (i = 1; i < nodes_count; i++) {
+		ok &= report(i);
+	}
+	return !ok;
+}